@@ -2,6 +2,7 @@
 #include "Win32/stdafx.h"
 #endif
 #include <DK.h>
+#include "framepacer.h"
 
 
 class SampleApp : public DKApplication
@@ -48,7 +49,10 @@ public:
         }
         DKLogI("MemoryPool Usage: %.1fMB / %.1fMB", double(usedBytes) / (1024 * 1024), double(DKMemoryPoolSize()) / (1024 * 1024));
         delete[] buckets;
+
+        framePacer.LogStats("Render");
     }
 
     DKResourcePool resourcePool;
+    FramePacer framePacer;  // used by the render thread, call SetTargetRate(0) for uncapped
 };
@@ -0,0 +1,176 @@
+#pragma once
+#include <algorithm>
+#include <DK.h>
+
+// Command buffers of a queue for the frame loop.
+// A command buffer can not be recorded again once committed (command
+// buffers of Metal are single use), so instead of resetting them the pool
+// keeps 'spareCount' new command buffers ready: Acquire() takes one, and
+// when a committed buffer completes, its completed handler creates the
+// replacement on the queue's completion thread and releases the buffer
+// completed before (not itself, its handler is still running). Creating and
+// destroying command buffers stays out of the frame loop, Acquire() only
+// creates one itself when all spares are taken (counted as a miss).
+class CommandBufferPool
+{
+public:
+    struct Stats
+    {
+        uint32_t created;   // command buffers created
+        uint32_t live;      // committed and not completed yet
+        uint32_t spare;     // ready for Acquire()
+        uint32_t recycled;  // completed and replaced by a spare
+        uint32_t misses;    // Acquire() found no spare
+    };
+
+    CommandBufferPool(DKCommandQueue* q, uint32_t spares = 3)
+        : queue(q)
+        , spareCount(std::max(spares, 1U))
+        , stats()
+    {
+        for (uint32_t i = 0; i < spareCount; ++i)
+        {
+            DKObject<DKCommandBuffer> buffer = queue->CreateCommandBuffer();
+            if (buffer == nullptr)
+                break;
+            spare.Add(buffer);
+            stats.created++;
+        }
+    }
+
+    // Waits for the committed buffers. Completed handlers access the pool
+    // only while holding 'condition', the last one may still be returning
+    // though, so its buffer ('retired') is not released here but handed to
+    // an empty command buffer committed after it, whose handler does not
+    // use the pool: it is released on the completion thread.
+    ~CommandBufferPool()
+    {
+        condition.Lock();
+        while (stats.live > 0)
+            condition.Wait();
+        DKObject<DKCommandBuffer> last = retired;
+        retired = nullptr;
+        condition.Unlock();
+
+        if (last)
+        {
+            DKObject<DKCommandBuffer> drain = queue->CreateCommandBuffer();
+            if (drain)
+            {
+                drain->AddCompletedHandler(DKFunction([last]() {})->Invocation());
+                drain->Commit();
+            }
+        }
+    }
+
+    DKObject<DKCommandBuffer> Acquire()
+    {
+        DKObject<DKCommandBuffer> buffer;
+        condition.Lock();
+        if (spare.Count() > 0)
+        {
+            buffer = spare.Value(spare.Count() - 1);
+            spare.Remove(spare.Count() - 1);
+        }
+        else
+            stats.misses++;
+        condition.Unlock();
+
+        if (buffer == nullptr)
+        {
+            buffer = queue->CreateCommandBuffer();
+            if (buffer)
+            {
+                condition.Lock();
+                stats.created++;
+                condition.Unlock();
+            }
+        }
+        return buffer;
+    }
+
+    // Commits a command buffer of Acquire(), the pool holds it until completed.
+    // An acquired buffer which is not committed is simply released.
+    bool Commit(DKCommandBuffer* buffer)
+    {
+        condition.Lock();
+        inFlight.Add(buffer);
+        stats.live++;
+        condition.Unlock();
+
+        buffer->AddCompletedHandler(DKFunction([this, buffer]()
+        {
+            DKObject<DKCommandBuffer> replacement;
+            condition.Lock();
+            const bool needed = spare.Count() < spareCount;
+            condition.Unlock();
+            if (needed)
+                replacement = queue->CreateCommandBuffer();
+
+            DKObject<DKCommandBuffer> previous;
+            condition.Lock();
+            previous = retired;
+            retired = Release(buffer);
+            if (replacement)
+            {
+                spare.Add(replacement);
+                stats.created++;
+            }
+            stats.recycled++;
+            condition.Broadcast();
+            condition.Unlock();
+            // 'previous' is destroyed here, on the completion thread.
+        })->Invocation());
+
+        if (buffer->Commit())
+            return true;
+
+        condition.Lock();
+        DKObject<DKCommandBuffer> failed = Release(buffer);
+        condition.Broadcast();
+        condition.Unlock();
+        return false;
+    }
+
+    Stats GetStats() const
+    {
+        condition.Lock();
+        Stats result = stats;
+        result.spare = static_cast<uint32_t>(spare.Count());
+        condition.Unlock();
+        return result;
+    }
+
+    void LogStats(const char* name) const
+    {
+        const Stats s = GetStats();
+        DKLog("%s command buffers: %u created, %u recycled, %u live, %u spare, %u misses",
+              name, s.created, s.recycled, s.live, s.spare, s.misses);
+    }
+
+private:
+    // removes 'buffer' from inFlight, condition must be locked.
+    DKObject<DKCommandBuffer> Release(DKCommandBuffer* buffer)
+    {
+        DKObject<DKCommandBuffer> result;
+        for (size_t i = 0; i < inFlight.Count(); ++i)
+        {
+            if (inFlight.Value(i) == buffer)
+            {
+                result = inFlight.Value(i);
+                inFlight.Remove(i);
+                stats.live--;
+                break;
+            }
+        }
+        return result;
+    }
+
+    DKObject<DKCommandQueue> queue;
+    const uint32_t spareCount;
+    DKArray<DKObject<DKCommandBuffer>> spare;
+    DKArray<DKObject<DKCommandBuffer>> inFlight;
+    DKObject<DKCommandBuffer> retired;  // completed last, released by the next completion
+    Stats stats;
+    mutable DKCondition condition;
+};
@@ -0,0 +1,195 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <algorithm>
+#include <DK.h>
+
+// Paces a render loop to a target frame rate, or leaves it uncapped.
+//
+//   framePacer.BeginFrame();           // sleeps until the frame is due
+//   ... sample input, record and commit
+//   framePacer.Present(swapChain);
+//
+// Frames are scheduled on a fixed interval, BeginFrame() sleeps only for
+// what the previous frame left of it. Present() is timed: a present
+// blocked by the display (vsync) re-anchors the schedule to its return,
+// so the pacer does not drift against the swap chain.
+// With just-in-time enabled, BeginFrame() sleeps until the predicted work
+// time before the deadline instead of starting right after the previous
+// frame, input and animation are sampled as late as possible.
+class FramePacer
+{
+public:
+    enum : uint32_t
+    {
+        HistogramBuckets = 66,  // 0.5ms each up to 32ms, then 32-64ms and longer
+    };
+
+    FramePacer(double targetRate = 60.0, bool jit = false)
+        : interval(0.0)
+        , justInTime(jit)
+        , deadline(0.0)
+        , frameStart(0.0)
+        , lastPresent(0.0)
+        , predictedWork(0.0)
+    {
+        SetTargetRate(targetRate);
+        ResetStats();
+        clock.Reset();
+    }
+
+    // frames per second, 0 for uncapped.
+    void SetTargetRate(double rate) { interval = rate > 0.0 ? 1.0 / rate : 0.0; }
+    double TargetRate() const { return interval > 0.0 ? 1.0 / interval : 0.0; }
+    void SetJustInTime(bool jit) { justInTime = jit; }
+
+    void BeginFrame()
+    {
+        if (interval > 0.0)
+        {
+            const double now = clock.Elapsed();
+            if (deadline + interval < now)
+                deadline = now; // fell behind, do not catch up with short frames
+            const double next = deadline + interval;
+            if (justInTime)
+                SleepUntil(next - predictedWork - JustInTimeMargin);
+            else
+                SleepUntil(deadline);
+            deadline = next;
+        }
+        frameStart = clock.Elapsed();
+    }
+
+    bool Present(DKSwapChain* swapChain)
+    {
+        const double presentStart = clock.Elapsed();
+        const bool result = swapChain->Present();
+        const double now = clock.Elapsed();
+
+        const double work = presentStart - frameStart;
+        const double presentTime = now - presentStart;
+        // rise at once, decay slowly: a late frame costs more than an early one.
+        predictedWork = work > predictedWork ? work : predictedWork + (work - predictedWork) * 0.1;
+        if (interval > 0.0 && presentTime > PresentBlockThreshold)
+            deadline = now;
+
+        if (frames > 0)
+        {
+            const double frameTime = now - lastPresent;
+            Record(frameTimes, frameTime);
+            minFrameTime = std::min(minFrameTime, frameTime);
+            maxFrameTime = std::max(maxFrameTime, frameTime);
+            totalFrameTime += frameTime;
+        }
+        Record(workTimes, work);
+        totalPresentTime += presentTime;
+        lastPresent = now;
+        frames++;
+        return result;
+    }
+
+    uint64_t FrameCount() const { return frames; }
+
+    void ResetStats()
+    {
+        frames = 0;
+        minFrameTime = 1e9;
+        maxFrameTime = 0.0;
+        totalFrameTime = 0.0;
+        totalPresentTime = 0.0;
+        std::fill(std::begin(frameTimes), std::end(frameTimes), 0);
+        std::fill(std::begin(workTimes), std::end(workTimes), 0);
+    }
+
+    // Frame times (present to present) and work times (frame start to
+    // present) as histograms.
+    void LogStats(const char* name) const
+    {
+        if (frames < 2)
+            return;
+        const uint64_t intervals = frames - 1;
+        char target[32] = "uncapped";
+        if (interval > 0.0)
+            snprintf(target, sizeof(target), "%.0f", TargetRate());
+        DKLog("%s frames: %llu, %.1f fps (target %s), frame time avg %.2fms min %.2fms max %.2fms, present avg %.2fms",
+              name, (unsigned long long)frames, double(intervals) / totalFrameTime,
+              target,
+              totalFrameTime / intervals * 1000.0, minFrameTime * 1000.0, maxFrameTime * 1000.0,
+              totalPresentTime / frames * 1000.0);
+        DKLog("  frame time p50 %.1fms, p95 %.1fms, p99 %.1fms; work time p50 %.1fms, p95 %.1fms, p99 %.1fms",
+              Percentile(frameTimes, 0.5), Percentile(frameTimes, 0.95), Percentile(frameTimes, 0.99),
+              Percentile(workTimes, 0.5), Percentile(workTimes, 0.95), Percentile(workTimes, 0.99));
+        for (uint32_t i = 0; i < HistogramBuckets; ++i)
+        {
+            if (frameTimes[i] == 0 && workTimes[i] == 0)
+                continue;
+            const double lower = BucketLowerBound(i);
+            const uint32_t bar = static_cast<uint32_t>(uint64_t(frameTimes[i]) * 40 / intervals);
+            DKLog("  %5.1fms%s frame %6u, work %6u %s", lower, i + 1 < HistogramBuckets ? " " : "+",
+                  frameTimes[i], workTimes[i], std::string(bar, '#').c_str());
+        }
+    }
+
+private:
+    static constexpr double SpinThreshold = 0.002;  // yield instead of sleeping the last part
+    static constexpr double JustInTimeMargin = 0.001;
+    static constexpr double PresentBlockThreshold = 0.001;
+
+    void SleepUntil(double t)
+    {
+        for (double remaining = t - clock.Elapsed(); remaining > 0.0; remaining = t - clock.Elapsed())
+        {
+            if (remaining > SpinThreshold)
+                DKThread::Sleep(remaining - SpinThreshold);
+            else
+                DKThread::Sleep(0.0);
+        }
+    }
+
+    static uint32_t Bucket(double seconds)
+    {
+        const double ms = seconds * 1000.0;
+        if (ms < 32.0)
+            return static_cast<uint32_t>(ms * 2.0);
+        return ms < 64.0 ? HistogramBuckets - 2 : HistogramBuckets - 1;
+    }
+    static double BucketLowerBound(uint32_t bucket)
+    {
+        return bucket < HistogramBuckets - 2 ? bucket * 0.5 : (bucket == HistogramBuckets - 2 ? 32.0 : 64.0);
+    }
+    static void Record(uint32_t* histogram, double seconds)
+    {
+        histogram[Bucket(std::max(seconds, 0.0))]++;
+    }
+    // upper bound of the bucket holding the percentile, in ms.
+    static double Percentile(const uint32_t* histogram, double p)
+    {
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < HistogramBuckets; ++i)
+            total += histogram[i];
+        uint64_t count = 0;
+        for (uint32_t i = 0; i < HistogramBuckets; ++i)
+        {
+            count += histogram[i];
+            if (count > 0 && count >= p * total)
+                return i + 1 < HistogramBuckets ? BucketLowerBound(i + 1) : BucketLowerBound(i);
+        }
+        return 0.0;
+    }
+
+    DKTimer clock;
+    double interval;
+    bool justInTime;
+    double deadline;        // present time of the current frame
+    double frameStart;
+    double lastPresent;
+    double predictedWork;
+
+    uint64_t frames;
+    double minFrameTime;
+    double maxFrameTime;
+    double totalFrameTime;
+    double totalPresentTime;
+    uint32_t frameTimes[HistogramBuckets];
+    uint32_t workTimes[HistogramBuckets];
+};
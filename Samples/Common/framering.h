@@ -0,0 +1,149 @@
+#pragma once
+#include <algorithm>
+#include <DK.h>
+
+// Host visible uniform buffer with one region per frame in flight, each
+// region bound by a binding set of its own at its offset in the buffer.
+// Begin() returns the region of the next frame once the GPU has completed
+// the command buffer that last used it, End() ties the region to the
+// command buffer of the frame. The CPU writes frame N+1 while the GPU reads
+// frame N, and waits only when it gets 'framesInFlight' frames ahead.
+class FrameUniformRing
+{
+public:
+    enum : size_t
+    {
+        OffsetAlignment = 256,  // max. minUniformBufferOffsetAlignment of devices
+    };
+
+    struct Frame
+    {
+        uint32_t index;
+        size_t offset;
+        void* contents;
+        DKShaderBindingSet* bindingSet;
+    };
+
+    FrameUniformRing(DKGraphicsDevice* device, size_t uniformLength,
+                     const DKShaderBindingSetLayout& layout, uint32_t uniformBinding = 0,
+                     uint32_t framesInFlight = 3)
+        : regionLength((uniformLength + OffsetAlignment - 1) & ~size_t(OffsetAlignment - 1))
+        , current(0)
+        , stalls(0)
+        , stallTime(0.0)
+    {
+        const uint32_t count = std::max(framesInFlight, 1U);
+        buffer = device->CreateBuffer(regionLength * count, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
+        regions.Resize(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            Region& region = regions.Value(i);
+            region.bindingSet = device->CreateShaderBindingSet(layout);
+            region.inFlight = false;
+            if (buffer && region.bindingSet)
+                region.bindingSet->SetBuffer(uniformBinding, buffer, regionLength * i, uniformLength);
+        }
+    }
+
+    ~FrameUniformRing()
+    {
+        WaitIdle();
+    }
+
+    bool IsValid() const
+    {
+        if (buffer == nullptr)
+            return false;
+        for (const Region& region : regions)
+        {
+            if (region.bindingSet == nullptr)
+                return false;
+        }
+        return true;
+    }
+
+    uint32_t FramesInFlight() const { return static_cast<uint32_t>(regions.Count()); }
+
+    // Binding set of every region, to set bindings other than the uniform buffer.
+    DKShaderBindingSet* BindingSet(uint32_t index) { return regions.Value(index).bindingSet; }
+
+    Frame Begin()
+    {
+        condition.Lock();
+        if (regions.Value(current).inFlight)
+        {
+            DKTimer timer;
+            timer.Reset();
+            while (regions.Value(current).inFlight)
+                condition.Wait();
+            stalls++;
+            stallTime += timer.Elapsed();
+        }
+        condition.Unlock();
+
+        const size_t offset = regionLength * current;
+        return { current, offset, reinterpret_cast<uint8_t*>(buffer->Contents()) + offset, regions.Value(current).bindingSet };
+    }
+
+    // Call before committing the command buffer of the frame, and Cancel()
+    // if it could not be committed (its completed handler is never called).
+    void End(DKCommandBuffer* commandBuffer)
+    {
+        buffer->Flush();
+
+        condition.Lock();
+        regions.Value(current).inFlight = true;
+        condition.Unlock();
+
+        const uint32_t index = current;
+        commandBuffer->AddCompletedHandler(DKFunction([this, index]()
+        {
+            condition.Lock();
+            regions.Value(index).inFlight = false;
+            condition.Broadcast();
+            condition.Unlock();
+        })->Invocation());
+
+        current = (current + 1) % regions.Count();
+    }
+
+    // Releases the region of End() 'index' whose command buffer was not committed.
+    void Cancel(uint32_t index)
+    {
+        condition.Lock();
+        regions.Value(index).inFlight = false;
+        condition.Broadcast();
+        condition.Unlock();
+    }
+
+    // Waits until the GPU has completed all frames.
+    void WaitIdle()
+    {
+        condition.Lock();
+        for (const Region& region : regions)
+        {
+            while (region.inFlight)
+                condition.Wait();
+        }
+        condition.Unlock();
+    }
+
+    // Frames Begin() had to wait for the GPU.
+    uint32_t Stalls() const { return stalls; }
+    double StallTime() const { return stallTime; }
+
+private:
+    struct Region
+    {
+        DKObject<DKShaderBindingSet> bindingSet;
+        bool inFlight;
+    };
+
+    DKObject<DKGpuBuffer> buffer;
+    const size_t regionLength;
+    DKArray<Region> regions;
+    uint32_t current;
+    uint32_t stalls;
+    double stallTime;
+    DKCondition condition;
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include <cmath>
+#include <DK.h>
+
+// Frustum planes of a (model-)view-projection matrix, row vector convention
+// (clip = p * m). Planes are normalized, their dot product with a point is
+// the distance to the plane, positive inside.
+struct Frustum
+{
+    enum { Left, Right, Bottom, Top, Near, Far };
+    float planes[6][4];
+
+    Frustum(const DKMatrix4& m)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            planes[Left][i] = m.m[i][3] + m.m[i][0];
+            planes[Right][i] = m.m[i][3] - m.m[i][0];
+            planes[Bottom][i] = m.m[i][3] + m.m[i][1];
+            planes[Top][i] = m.m[i][3] - m.m[i][1];
+            planes[Near][i] = m.m[i][3] + m.m[i][2];   // -w, conservative for 0...w
+            planes[Far][i] = m.m[i][3] - m.m[i][2];
+        }
+        for (auto& p : planes)
+        {
+            const float length = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+            if (length > 0.0f)
+            {
+                for (float& f : p)
+                    f /= length;
+            }
+        }
+    }
+
+    // false if the sphere is entirely outside.
+    bool Intersects(const DKVector3& center, float radius) const
+    {
+        for (const auto& p : planes)
+        {
+            if (p[0] * center.x + p[1] * center.y + p[2] * center.z + p[3] < -radius)
+                return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,134 @@
+#pragma once
+#include <cstring>
+#include <DK.h>
+
+// Range of indices drawn with one draw call.
+// 'vertexOffset' is added to each index by the GPU (base vertex).
+struct IndexedDraw
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+    int32_t materialId;
+};
+
+// Index buffer contents with the narrowest index type that fits.
+// If the mesh has too many vertices for 16-bit indices and splitting is
+// allowed, triangles are grouped into chunks of at most MaxVertices16
+// vertices. Each chunk gets its own copy of the vertices it references,
+// contiguous in the output vertex order, so chunk indices fit 16 bits
+// relative to the chunk's base vertex.
+// 'vertexRemap' is then the output vertex order (output vertex i is input
+// vertex vertexRemap[i]); if empty, vertices are used as they are.
+struct IndexBufferData
+{
+    enum : uint32_t
+    {
+        MaxVertices16 = 0xffff, // 0xffff itself is kept free (primitive restart)
+    };
+
+    DKArray<uint8_t> data;
+    DKIndexType indexType;
+    DKArray<IndexedDraw> draws;
+    DKArray<uint32_t> vertexRemap;
+
+    uint32_t IndexSize() const { return indexType == DKIndexType::UInt16 ? 2 : 4; }
+    uint32_t IndexCount() const { return static_cast<uint32_t>(data.Count() / IndexSize()); }
+    uint32_t VertexCount(uint32_t numVertices) const
+    {
+        return vertexRemap.IsEmpty() ? numVertices : static_cast<uint32_t>(vertexRemap.Count());
+    }
+};
+
+inline DKIndexType IndexTypeForVertexCount(size_t numVertices)
+{
+    return numVertices <= IndexBufferData::MaxVertices16 ? DKIndexType::UInt16 : DKIndexType::UInt32;
+}
+
+// Builds 'out' from 32-bit triangle list indices. 'ranges' are drawn in
+// order (e.g. submeshes), with one range covering all indices if null.
+inline void BuildIndexBufferData(const uint32_t* indices, size_t numIndices, size_t numVertices,
+                                 const IndexedDraw* ranges, size_t numRanges,
+                                 IndexBufferData& out, bool allowSplit = true)
+{
+    IndexedDraw whole = { 0, static_cast<uint32_t>(numIndices), 0, -1 };
+    if (ranges == nullptr)
+    {
+        ranges = &whole;
+        numRanges = 1;
+    }
+
+    out.data.Clear();
+    out.draws.Clear();
+    out.vertexRemap.Clear();
+    out.indexType = IndexTypeForVertexCount(numVertices);
+
+    if (out.indexType == DKIndexType::UInt16)
+    {
+        out.data.Resize(numIndices * sizeof(uint16_t));
+        uint16_t* dst = reinterpret_cast<uint16_t*>((uint8_t*)out.data);
+        for (size_t i = 0; i < numIndices; ++i)
+            dst[i] = static_cast<uint16_t>(indices[i]);
+        out.draws.Add(ranges, numRanges);
+        return;
+    }
+    if (!allowSplit)
+    {
+        out.data.Add(reinterpret_cast<const uint8_t*>(indices), numIndices * sizeof(uint32_t));
+        out.draws.Add(ranges, numRanges);
+        return;
+    }
+
+    // split each range into chunks, in triangle order.
+    out.indexType = DKIndexType::UInt16;
+    out.data.Resize(numIndices * sizeof(uint16_t));
+    uint16_t* dst = reinterpret_cast<uint16_t*>((uint8_t*)out.data);
+
+    DKArray<uint32_t> chunkOf;     // chunk that last used a vertex, 0: none
+    DKArray<uint16_t> localIndex;  // index of a vertex in that chunk
+    chunkOf.Resize(numVertices, 0);
+    localIndex.Resize(numVertices, 0);
+    uint32_t chunk = 0;
+
+    size_t numOut = 0;
+    for (size_t r = 0; r < numRanges; ++r)
+    {
+        const IndexedDraw& range = ranges[r];
+        size_t t = range.firstIndex;
+        const size_t end = size_t(range.firstIndex) + range.indexCount;
+        while (t + 2 < end)
+        {
+            ++chunk;
+            const uint32_t base = static_cast<uint32_t>(out.vertexRemap.Count());
+            const uint32_t first = static_cast<uint32_t>(numOut);
+            uint32_t chunkVertices = 0;
+            for (; t + 2 < end; t += 3)
+            {
+                // vertices of this triangle not yet in the chunk
+                const uint32_t* tri = &indices[t];
+                uint32_t newVertices = 0;
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (chunkOf.Value(tri[k]) != chunk &&
+                        (k < 1 || tri[k] != tri[0]) && (k < 2 || tri[k] != tri[1]))
+                        newVertices++;
+                }
+                if (chunkVertices + newVertices > IndexBufferData::MaxVertices16)
+                    break;
+                for (int k = 0; k < 3; ++k)
+                {
+                    const uint32_t v = tri[k];
+                    if (chunkOf.Value(v) != chunk)
+                    {
+                        chunkOf.Value(v) = chunk;
+                        localIndex.Value(v) = static_cast<uint16_t>(chunkVertices++);
+                        out.vertexRemap.Add(v);
+                    }
+                    dst[numOut++] = localIndex.Value(v);
+                }
+            }
+            out.draws.Add({ first, static_cast<uint32_t>(numOut) - first, static_cast<int32_t>(base), range.materialId });
+        }
+    }
+    out.data.Resize(numOut * sizeof(uint16_t));
+}
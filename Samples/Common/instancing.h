@@ -0,0 +1,114 @@
+#pragma once
+#include <algorithm>
+#include <DK.h>
+
+#include "frustum.h"
+
+// Instances of one LOD drawn with one draw, the draw's firstInstance is the
+// first matrix of the batch (gl_InstanceIndex includes it).
+struct InstanceBatch
+{
+    uint32_t lod;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
+
+// Transforms of the instances of a mesh, culled on the CPU.
+// Cull() writes the transforms of the instances inside the frustum to a
+// storage buffer the vertex shader indexes with gl_InstanceIndex, grouped
+// by LOD, so the visible instances are drawn with one draw per LOD.
+class MeshInstances
+{
+public:
+    void Clear() { transforms.Clear(); }
+    void Add(const DKMatrix4& transform) { transforms.Add(transform); }
+
+    // countX * countZ instances 'spacing' apart on the xz plane, centered at the origin.
+    void AddGrid(uint32_t countX, uint32_t countZ, float spacing)
+    {
+        for (uint32_t z = 0; z < countZ; ++z)
+        {
+            for (uint32_t x = 0; x < countX; ++x)
+            {
+                DKMatrix4 transform = DKMatrix4::identity;
+                transform.m[3][0] = (float(x) - float(countX - 1) * 0.5f) * spacing;
+                transform.m[3][2] = (float(z) - float(countZ - 1) * 0.5f) * spacing;
+                transforms.Add(transform);
+            }
+        }
+    }
+
+    uint32_t Count() const { return static_cast<uint32_t>(transforms.Count()); }
+
+    // 'model' is applied before the transform of an instance, 'center' and
+    // 'radius' bound the mesh in the space 'model' transforms from.
+    // selectLod(modelView) returns the LOD (< numLods) of a visible instance.
+    // Writes the transforms of visible instances to 'visibleTransforms'
+    // (Count() at most) and their batches to 'batches'.
+    // Returns the number of visible instances.
+    template <typename SelectLodFn>
+    uint32_t Cull(const DKMatrix4& model, const DKMatrix4& view, const DKMatrix4& projection,
+                  const DKVector3& center, float radius, uint32_t numLods, SelectLodFn&& selectLod,
+                  DKMatrix4* visibleTransforms, DKArray<InstanceBatch>& batches)
+    {
+        const Frustum frustum(view * projection);
+        const DKVector3 c = Transform(center, model);
+        const float r = radius * Scale(model);
+        numLods = std::max(numLods, 1U);
+
+        visible.Clear();
+        lodCounts.Clear();
+        lodCounts.Resize(numLods, 0);
+        for (uint32_t i = 0; i < transforms.Count(); ++i)
+        {
+            const DKMatrix4& t = transforms.Value(i);
+            if (!frustum.Intersects(Transform(c, t), r * Scale(t)))
+                continue;
+            const uint32_t lod = std::min(static_cast<uint32_t>(selectLod(model * t * view)), numLods - 1);
+            visible.Add({ i, lod });
+            lodCounts.Value(lod)++;
+        }
+
+        // instances are written in LOD order, a batch for each LOD with instances.
+        batches.Clear();
+        uint32_t first = 0;
+        for (uint32_t lod = 0; lod < numLods; ++lod)
+        {
+            const uint32_t count = lodCounts.Value(lod);
+            lodCounts.Value(lod) = first;
+            if (count > 0)
+                batches.Add({ lod, first, count });
+            first += count;
+        }
+        for (const Visible& v : visible)
+            visibleTransforms[lodCounts.Value(v.lod)++] = transforms.Value(v.index);
+
+        return static_cast<uint32_t>(visible.Count());
+    }
+
+private:
+    static DKVector3 Transform(const DKVector3& v, const DKMatrix4& m)
+    {
+        return DKVector3(v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + m.m[3][0],
+                         v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + m.m[3][1],
+                         v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2] + m.m[3][2]);
+    }
+    // largest axis scale, for bounding spheres.
+    static float Scale(const DKMatrix4& m)
+    {
+        float scale = 0.0f;
+        for (int i = 0; i < 3; ++i)
+            scale = std::max(scale, DKVector3(m.m[i][0], m.m[i][1], m.m[i][2]).Length());
+        return scale;
+    }
+
+    struct Visible
+    {
+        uint32_t index;
+        uint32_t lod;
+    };
+
+    DKArray<DKMatrix4> transforms;
+    DKArray<Visible> visible;
+    DKArray<uint32_t> lodCounts;
+};
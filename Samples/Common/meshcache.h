@@ -0,0 +1,254 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <DK.h>
+
+// Binary mesh cache file, stored next to the source file as
+// "<source>.<flags>.meshcache" (see MeshCachePath()).
+//
+// Layout (little-endian, all sections aligned to MeshCacheHeader::Alignment):
+//   MeshCacheHeader
+//   vertex data   (vertexCount * vertexStride bytes)
+//   index data    (indexCount * uint32_t)
+//   submesh data  (submeshCount * MeshCacheSubmesh)
+//
+// Vertex and index sections are stored exactly as they are uploaded to the
+// GPU, so they can be copied from the mapped file without any conversion.
+// The cache is valid if the size of the source file matches and either its
+// modification time or its content hash matches. After a match of the hash,
+// the stored time is updated (UpdateCacheSourceTime()), so the next load does
+// not hash the source again.
+
+struct MeshCacheKey
+{
+    uint64_t sourceSize;
+    int64_t sourceTime;
+};
+
+struct MeshCacheSubmesh
+{
+    uint32_t indexStart;
+    uint32_t indexCount;
+    int32_t materialId;
+    uint32_t reserved;
+};
+
+struct MeshCacheHeader
+{
+    enum : uint32_t
+    {
+        Magic = 0x434d4b44, // 'DKMC'
+        Version = 2,
+        Alignment = 256,
+    };
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;         // loader options the data was built with
+    uint32_t vertexStride;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t sourceHash;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t submeshCount;
+    uint32_t reserved;
+    float aabbMin[3];
+    float aabbMax[3];
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t submeshOffset;
+    uint64_t fileLength;
+};
+
+inline uint64_t HashMeshCacheData(const void* data, size_t length)
+{
+    // multiply-xorshift over 8-byte words. (not cryptographic)
+    const uint64_t m1 = 0x9e3779b97f4a7c15ULL;
+    const uint64_t m2 = 0xbf58476d1ce4e5b9ULL;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint64_t h = length * m1;
+    size_t n = length / 8;
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t k;
+        memcpy(&k, p + i * 8, 8);
+        k *= m1;
+        k ^= k >> 29;
+        h = (h ^ k) * m2;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + n * 8, length - n * 8);
+    h = (h ^ (tail * m1)) * m2;
+    h ^= h >> 31;
+    return h;
+}
+
+inline bool HashMeshCacheSource(const char* sourcePath, uint64_t& hash)
+{
+    DKObject<DKFileMap> fileMap = DKFileMap::Open(sourcePath, 0, false);
+    if (fileMap == nullptr)
+        return false;
+    hash = HashMeshCacheData(fileMap->LockShared(), fileMap->Length());
+    fileMap->UnlockShared();
+    return true;
+}
+
+// Loads of one source with different flags (Mesh and Material samples share
+// their .obj) get separate files instead of overwriting each other's cache.
+inline std::string MeshCachePath(const char* sourcePath, uint32_t flags)
+{
+    return std::string(sourcePath) + "." + std::to_string(flags) + ".meshcache";
+}
+
+inline bool GetMeshCacheKey(const char* sourcePath, MeshCacheKey& key)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(sourcePath, &st) != 0)
+        return false;
+#else
+    struct stat st;
+    if (stat(sourcePath, &st) != 0)
+        return false;
+#endif
+    key.sourceSize = static_cast<uint64_t>(st.st_size);
+    key.sourceTime = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+// Validates header, section bounds, submesh ranges and index values of a
+// mapped cache file, a truncated or corrupt file is rejected.
+inline const MeshCacheHeader* ValidateMeshCache(const void* data, size_t length,
+                                                const char* sourcePath,
+                                                const MeshCacheKey& key,
+                                                uint32_t flags,
+                                                uint32_t vertexStride)
+{
+    if (data == nullptr || length < sizeof(MeshCacheHeader))
+        return nullptr;
+
+    const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(data);
+    if (header->magic != MeshCacheHeader::Magic ||
+        header->version != MeshCacheHeader::Version ||
+        header->flags != flags ||
+        header->vertexStride != vertexStride ||
+        header->fileLength != length ||
+        header->vertexOffset % MeshCacheHeader::Alignment != 0 ||
+        header->indexOffset % MeshCacheHeader::Alignment != 0 ||
+        header->submeshOffset % MeshCacheHeader::Alignment != 0)
+        return nullptr;
+
+    auto inBounds = [length](uint64_t offset, uint64_t size)
+    {
+        return offset <= length && size <= length - offset;
+    };
+    if (!inBounds(header->vertexOffset, uint64_t(header->vertexCount) * vertexStride) ||
+        !inBounds(header->indexOffset, uint64_t(header->indexCount) * sizeof(uint32_t)) ||
+        !inBounds(header->submeshOffset, uint64_t(header->submeshCount) * sizeof(MeshCacheSubmesh)))
+        return nullptr;
+
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(data);
+    const MeshCacheSubmesh* submeshes = reinterpret_cast<const MeshCacheSubmesh*>(base + header->submeshOffset);
+    for (uint32_t i = 0; i < header->submeshCount; ++i)
+    {
+        if (submeshes[i].indexStart > header->indexCount ||
+            submeshes[i].indexCount > header->indexCount - submeshes[i].indexStart)
+            return nullptr;
+    }
+    const uint32_t* indices = reinterpret_cast<const uint32_t*>(base + header->indexOffset);
+    uint32_t maxIndex = 0;
+    for (uint32_t i = 0; i < header->indexCount; ++i)
+        maxIndex = std::max(maxIndex, indices[i]);
+    if (header->indexCount > 0 && maxIndex >= header->vertexCount)
+        return nullptr;
+
+    if (header->sourceSize != key.sourceSize)
+        return nullptr;
+    if (header->sourceTime != key.sourceTime)
+    {
+        // source has been touched, compare contents.
+        uint64_t hash;
+        if (!HashMeshCacheSource(sourcePath, hash) || hash != header->sourceHash)
+            return nullptr;
+    }
+    return header;
+}
+
+// Stores the modification time of a source whose hash still matches at
+// 'timeOffset' of a cache file (not mapped). Used by the texture cache too.
+inline bool UpdateCacheSourceTime(const char* cachePath, size_t timeOffset, const MeshCacheKey& key)
+{
+    std::fstream file(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file)
+        return false;
+    file.seekp(timeOffset);
+    file.write(reinterpret_cast<const char*>(&key.sourceTime), sizeof(key.sourceTime));
+    file.close();
+    return !file.fail();
+}
+
+inline bool WriteMeshCache(const char* cachePath,
+                           const char* sourcePath,
+                           const MeshCacheKey& key,
+                           uint32_t flags,
+                           const void* vertexData, uint32_t vertexCount, uint32_t vertexStride,
+                           const uint32_t* indexData, uint32_t indexCount,
+                           const MeshCacheSubmesh* submeshes, uint32_t submeshCount,
+                           const DKAabb& aabb)
+{
+    auto align = [](uint64_t offset)
+    {
+        return (offset + MeshCacheHeader::Alignment - 1) & ~uint64_t(MeshCacheHeader::Alignment - 1);
+    };
+
+    MeshCacheHeader header = {};
+    header.magic = MeshCacheHeader::Magic;
+    header.version = MeshCacheHeader::Version;
+    header.flags = flags;
+    header.vertexStride = vertexStride;
+    header.sourceSize = key.sourceSize;
+    header.sourceTime = key.sourceTime;
+    if (!HashMeshCacheSource(sourcePath, header.sourceHash))
+        return false;
+    header.vertexCount = vertexCount;
+    header.indexCount = indexCount;
+    header.submeshCount = submeshCount;
+    memcpy(header.aabbMin, &aabb.positionMin, sizeof(header.aabbMin));
+    memcpy(header.aabbMax, &aabb.positionMax, sizeof(header.aabbMax));
+    header.vertexOffset = align(sizeof(MeshCacheHeader));
+    header.indexOffset = align(header.vertexOffset + uint64_t(vertexCount) * vertexStride);
+    header.submeshOffset = align(header.indexOffset + uint64_t(indexCount) * sizeof(uint32_t));
+    header.fileLength = header.submeshOffset + uint64_t(submeshCount) * sizeof(MeshCacheSubmesh);
+
+    std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+
+    auto writeAt = [&file](uint64_t offset, const void* p, uint64_t size)
+    {
+        static const char zero[MeshCacheHeader::Alignment] = {};
+        uint64_t pos = static_cast<uint64_t>(file.tellp());
+        if (offset > pos)
+            file.write(zero, offset - pos);
+        if (size > 0)
+            file.write(reinterpret_cast<const char*>(p), size);
+    };
+    writeAt(0, &header, sizeof(header));
+    writeAt(header.vertexOffset, vertexData, uint64_t(vertexCount) * vertexStride);
+    writeAt(header.indexOffset, indexData, uint64_t(indexCount) * sizeof(uint32_t));
+    writeAt(header.submeshOffset, submeshes, uint64_t(submeshCount) * sizeof(MeshCacheSubmesh));
+    file.close();
+    if (!file)
+    {
+        remove(cachePath);
+        return false;
+    }
+    return true;
+}
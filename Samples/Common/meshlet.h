@@ -0,0 +1,338 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include <DK.h>
+
+#include "objmesh.h"
+#include "indexbuffer.h"
+#include "frustum.h"
+
+// Small cluster of triangles of one submesh, with bounds for culling.
+struct Meshlet
+{
+    uint32_t vertexOffset;      // first entry in SampleMeshlets vertices
+    uint32_t triangleOffset;    // first triangle in SampleMeshlets triangles and indices
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    int32_t materialId;
+
+    // bounding sphere
+    DKVector3 center;
+    float radius;
+    // normal cone: all triangle normals are within the cone around coneAxis.
+    // coneCutoff is the sine of the cone half angle, 1 if it can't be culled.
+    DKVector3 coneAxis;
+    float coneCutoff;
+};
+
+// Splits a welded SampleObjMesh into meshlets.
+// Triangles are added greedily to the current meshlet, preferring
+// neighbours that add the fewest vertices and whose normals are closest to
+// the meshlet's average normal, so meshlets are compact with tight cones.
+// For each meshlet, 'vertices' has the mesh vertex indices it uses and
+// 'triangles' has 3 local (8-bit) indices per triangle. 'indices' has the
+// same triangles with mesh vertex indices, in meshlet order, so a range of
+// meshlets can be drawn from one index buffer with the mesh vertex buffer.
+class SampleMeshlets
+{
+public:
+    enum : uint32_t
+    {
+        MaxVertices = 64,
+        MaxTriangles = 124,
+    };
+
+    void Build(const SampleObjMesh& mesh, uint32_t maxVertices = MaxVertices, uint32_t maxTriangles = MaxTriangles)
+    {
+        DKASSERT_DEBUG(maxVertices >= 3 && maxVertices <= 256);
+        DKASSERT_DEBUG(maxTriangles >= 1);
+
+        meshlets.Clear();
+        vertices.Clear();
+        triangles.Clear();
+        indices.Clear();
+
+        const uint32_t numVertices = mesh.GetVerticesCount();
+        const uint32_t numTriangles = mesh.GetIndicesCount() / 3;
+        const uint32_t* meshIndices = mesh.GetIndicesData();
+        const SampleObjMesh::Vertex* meshVertices = mesh.GetVerticesData();
+
+        // vertex -> triangles adjacency
+        DKArray<uint32_t> adjacencyOffsets;
+        DKArray<uint32_t> adjacency;
+        adjacencyOffsets.Resize(numVertices + 1, 0);
+        for (uint32_t i = 0; i < numTriangles * 3; ++i)
+            adjacencyOffsets.Value(meshIndices[i] + 1)++;
+        for (uint32_t v = 0; v < numVertices; ++v)
+            adjacencyOffsets.Value(v + 1) += adjacencyOffsets.Value(v);
+        adjacency.Resize(numTriangles * 3);
+        if (true)
+        {
+            DKArray<uint32_t> fill;
+            fill.Add(adjacencyOffsets, numVertices);
+            for (uint32_t t = 0; t < numTriangles; ++t)
+            {
+                for (int k = 0; k < 3; ++k)
+                    adjacency.Value(fill.Value(meshIndices[t * 3 + k])++) = t;
+            }
+        }
+
+        DKArray<DKVector3> normals;
+        normals.Resize(numTriangles);
+        for (uint32_t t = 0; t < numTriangles; ++t)
+        {
+            const DKVector3& p0 = meshVertices[meshIndices[t * 3]].inPos;
+            const DKVector3& p1 = meshVertices[meshIndices[t * 3 + 1]].inPos;
+            const DKVector3& p2 = meshVertices[meshIndices[t * 3 + 2]].inPos;
+            DKVector3 n = DKVector3::Cross(p1 - p0, p2 - p0);
+            const float length = n.Length();
+            normals.Value(t) = length > 0.0f ? n * (1.0f / length) : DKVector3(0, 0, 0);
+        }
+
+        DKArray<uint8_t> emitted;
+        emitted.Resize(numTriangles, 0);
+        DKArray<uint32_t> liveTriangles;    // triangles of a vertex not emitted yet
+        liveTriangles.Resize(numVertices);
+        for (uint32_t v = 0; v < numVertices; ++v)
+            liveTriangles.Value(v) = adjacencyOffsets.Value(v + 1) - adjacencyOffsets.Value(v);
+        DKArray<uint32_t> meshletOf;    // meshlet that last used a vertex, 0: none
+        DKArray<uint8_t> localIndex;
+        meshletOf.Resize(numVertices, 0);
+        localIndex.Resize(numVertices, 0);
+        DKArray<uint32_t> meshletTriangles;  // triangles of the current meshlet
+
+        const uint32_t numSubmeshes = mesh.GetSubmeshCount();
+        const SampleObjMesh::Submesh* submeshes = mesh.GetSubmeshData();
+        for (uint32_t s = 0; s < numSubmeshes; ++s)
+        {
+            const uint32_t first = submeshes[s].indexStart / 3;
+            const uint32_t last = first + submeshes[s].indexCount / 3;
+            uint32_t cursor = first;
+            uint32_t seed = ~0U;
+
+            for (;;)
+            {
+                if (seed == ~0U)
+                {
+                    while (cursor < last && emitted.Value(cursor))
+                        cursor++;
+                    if (cursor == last)
+                        break;
+                    seed = cursor;
+                }
+
+                Meshlet meshlet = {};
+                meshlet.vertexOffset = static_cast<uint32_t>(vertices.Count());
+                meshlet.triangleOffset = static_cast<uint32_t>(triangles.Count() / 3);
+                meshlet.materialId = submeshes[s].materialId;
+                const uint32_t id = static_cast<uint32_t>(meshlets.Count()) + 1;
+                DKVector3 normalSum(0, 0, 0);
+                meshletTriangles.Clear();
+
+                auto addTriangle = [&](uint32_t t)
+                {
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        const uint32_t v = meshIndices[t * 3 + k];
+                        if (meshletOf.Value(v) != id)
+                        {
+                            meshletOf.Value(v) = id;
+                            localIndex.Value(v) = static_cast<uint8_t>(meshlet.vertexCount++);
+                            vertices.Add(v);
+                        }
+                        triangles.Add(localIndex.Value(v));
+                        indices.Add(v);
+                    }
+                    meshlet.triangleCount++;
+                    meshletTriangles.Add(t);
+                    normalSum = normalSum + normals.Value(t);
+                    emitted.Value(t) = 1;
+                    for (int k = 0; k < 3; ++k)
+                        liveTriangles.Value(meshIndices[t * 3 + k])--;
+                };
+                addTriangle(seed);
+
+                while (meshlet.triangleCount < maxTriangles)
+                {
+                    DKVector3 axis = normalSum;
+                    axis.Normalize();
+
+                    // fewest new vertices, then most vertices left without
+                    // other triangles (avoids leaving holes), then normal.
+                    uint32_t best = ~0U;
+                    uint32_t bestNew = 4;
+                    uint32_t bestLive = ~0U;
+                    float bestDot = -2.0f;
+                    for (uint32_t i = meshlet.vertexOffset; i < vertices.Count(); ++i)
+                    {
+                        const uint32_t v = vertices.Value(i);
+                        for (uint32_t a = adjacencyOffsets.Value(v); a < adjacencyOffsets.Value(v + 1); ++a)
+                        {
+                            const uint32_t t = adjacency.Value(a);
+                            if (emitted.Value(t) || t < first || t >= last)
+                                continue;
+                            const uint32_t* tri = &meshIndices[t * 3];
+                            uint32_t numNew = 0;
+                            for (int k = 0; k < 3; ++k)
+                            {
+                                if (meshletOf.Value(tri[k]) != id &&
+                                    (k < 1 || tri[k] != tri[0]) && (k < 2 || tri[k] != tri[1]))
+                                    numNew++;
+                            }
+                            if (meshlet.vertexCount + numNew > maxVertices)
+                                continue;
+                            uint32_t live = 0;
+                            for (int k = 0; k < 3; ++k)
+                                live += liveTriangles.Value(tri[k]);
+                            const float d = DKVector3::Dot(normals.Value(t), axis);
+                            if (numNew < bestNew ||
+                                (numNew == bestNew && (live < bestLive || (live == bestLive && d > bestDot))))
+                            {
+                                best = t;
+                                bestNew = numNew;
+                                bestLive = live;
+                                bestDot = d;
+                            }
+                        }
+                    }
+                    if (best == ~0U)
+                        break;
+                    addTriangle(best);
+                }
+
+                ComputeBounds(meshlet, meshVertices, normals, meshletTriangles, normalSum);
+                meshlets.Add(meshlet);
+
+                // continue next to this meshlet, from its least connected border
+                seed = ~0U;
+                uint32_t seedLive = ~0U;
+                for (uint32_t i = meshlet.vertexOffset; i < vertices.Count(); ++i)
+                {
+                    const uint32_t v = vertices.Value(i);
+                    for (uint32_t a = adjacencyOffsets.Value(v); a < adjacencyOffsets.Value(v + 1); ++a)
+                    {
+                        const uint32_t t = adjacency.Value(a);
+                        if (emitted.Value(t) || t < first || t >= last)
+                            continue;
+                        const uint32_t* tri = &meshIndices[t * 3];
+                        const uint32_t live = liveTriangles.Value(tri[0]) + liveTriangles.Value(tri[1]) + liveTriangles.Value(tri[2]);
+                        if (live < seedLive)
+                        {
+                            seed = t;
+                            seedLive = live;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Appends draws for meshlets that may be visible, adjacent meshlets are
+    // merged into one draw. 'modelViewProjection' and 'cameraPosition' are
+    // in the mesh's object space. Returns the number of visible meshlets.
+    uint32_t Cull(const DKMatrix4& modelViewProjection, const DKVector3& cameraPosition, DKArray<IndexedDraw>& draws) const
+    {
+        const Frustum frustum(modelViewProjection);
+
+        uint32_t numVisible = 0;
+        IndexedDraw* lastDraw = nullptr;
+        for (const Meshlet& meshlet : meshlets)
+        {
+            bool visible = frustum.Intersects(meshlet.center, meshlet.radius);
+            if (visible && meshlet.coneCutoff < 1.0f)
+            {
+                // all triangles face away from the camera
+                const DKVector3 d = meshlet.center - cameraPosition;
+                if (DKVector3::Dot(d, meshlet.coneAxis) >= meshlet.coneCutoff * d.Length() + meshlet.radius)
+                    visible = false;
+            }
+            if (!visible)
+            {
+                lastDraw = nullptr;
+                continue;
+            }
+            numVisible++;
+            if (lastDraw && lastDraw->materialId == meshlet.materialId)
+                lastDraw->indexCount += meshlet.triangleCount * 3;
+            else
+            {
+                draws.Add({ meshlet.triangleOffset * 3, meshlet.triangleCount * 3, 0, meshlet.materialId });
+                lastDraw = &draws.Value(draws.Count() - 1);
+            }
+        }
+        return numVisible;
+    }
+
+    uint32_t GetMeshletCount() const {
+        return static_cast<uint32_t>(meshlets.Count()); }
+    const Meshlet* GetMeshletData() const {
+        return meshlets; }
+    const uint32_t* GetMeshletVertices() const {
+        return vertices; }
+    const uint8_t* GetMeshletTriangles() const {
+        return triangles; }
+    uint32_t GetIndicesCount() const {
+        return static_cast<uint32_t>(indices.Count()); }
+    const uint32_t* GetIndicesData() const {
+        return indices; }
+
+private:
+    void ComputeBounds(Meshlet& meshlet, const SampleObjMesh::Vertex* meshVertices,
+                       const DKArray<DKVector3>& normals, const DKArray<uint32_t>& meshletTriangles,
+                       const DKVector3& normalSum) const
+    {
+        auto position = [&](uint32_t i) -> const DKVector3&
+        {
+            return meshVertices[vertices.Value(meshlet.vertexOffset + i)].inPos;
+        };
+        auto distanceSq = [](const DKVector3& a, const DKVector3& b)
+        {
+            const DKVector3 d = a - b;
+            return DKVector3::Dot(d, d);
+        };
+
+        // Ritter's bounding sphere
+        uint32_t a = 0, b = 0;
+        for (uint32_t i = 1; i < meshlet.vertexCount; ++i)
+            if (distanceSq(position(i), position(0)) > distanceSq(position(a), position(0)))
+                a = i;
+        for (uint32_t i = 1; i < meshlet.vertexCount; ++i)
+            if (distanceSq(position(i), position(a)) > distanceSq(position(b), position(a)))
+                b = i;
+        DKVector3 center = (position(a) + position(b)) * 0.5f;
+        float radius = sqrtf(distanceSq(position(a), position(b))) * 0.5f;
+        for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+        {
+            const float d = sqrtf(distanceSq(position(i), center));
+            if (d > radius)
+            {
+                const float newRadius = (radius + d) * 0.5f;
+                center = center + (position(i) - center) * ((newRadius - radius) / d);
+                radius = newRadius;
+            }
+        }
+        meshlet.center = center;
+        meshlet.radius = radius;
+
+        // normal cone
+        meshlet.coneAxis = normalSum;
+        meshlet.coneCutoff = 1.0f;
+        if (normalSum.Length() <= 0.0f)
+            return;
+        meshlet.coneAxis.Normalize();
+        float minDot = 1.0f;
+        for (uint32_t t : meshletTriangles)
+        {
+            const DKVector3& n = normals.Value(t);
+            if (n.Length() > 0.0f)
+                minDot = std::min(minDot, DKVector3::Dot(n, meshlet.coneAxis));
+        }
+        if (minDot > 0.0f)
+            meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+    }
+
+    DKArray<Meshlet> meshlets;
+    DKArray<uint32_t> vertices;
+    DKArray<uint8_t> triangles;
+    DKArray<uint32_t> indices;
+};
@@ -0,0 +1,344 @@
+#pragma once
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <DK.h>
+
+// Post-load index/vertex buffer optimizations for triangle lists.
+//  - OptimizeVertexCache: Tipsify (Sander et al. 2007), reorders triangles
+//    for post-transform vertex cache reuse.
+//  - OptimizeOverdraw: splits the cache optimized order into clusters and
+//    sorts them so that outward facing clusters are drawn first.
+//  - OptimizeVertexFetch: reorders vertices in first-use order so vertex
+//    memory is read sequentially.
+// Apply them in this order; each pass only reorders, the mesh is unchanged.
+
+struct VertexCacheStats
+{
+    uint32_t vertexTransforms;  // vertices shaded, cache misses
+    float acmr;                 // average cache miss ratio, transforms per triangle (0.5 ~ 3.0)
+    float atvr;                 // average transform to vertex ratio (1.0 is optimal)
+};
+
+// Simulates a FIFO post-transform cache of 'cacheSize' entries.
+inline VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount,
+                                           size_t vertexCount, uint32_t cacheSize = 16)
+{
+    VertexCacheStats stats = {};
+    DKArray<uint32_t> timestamps;
+    timestamps.Resize(vertexCount);
+    uint32_t* ts = timestamps;
+    memset(ts, 0, sizeof(uint32_t) * vertexCount);
+
+    // vertex is in cache if it was inserted within the last cacheSize insertions.
+    uint32_t time = cacheSize + 1;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        uint32_t v = indices[i];
+        if (time - ts[v] > cacheSize)
+        {
+            ts[v] = time++;
+            stats.vertexTransforms++;
+        }
+    }
+
+    size_t referenced = 0;
+    for (size_t i = 0; i < vertexCount; ++i)
+        referenced += ts[i] != 0;
+
+    stats.acmr = indexCount ? float(stats.vertexTransforms) / float(indexCount / 3) : 0.0f;
+    stats.atvr = referenced ? float(stats.vertexTransforms) / float(referenced) : 0.0f;
+    return stats;
+}
+
+// Tipsify: fans around vertices that are likely still in the cache, and
+// restarts from the dead-end stack (recently used vertices) when stuck.
+// 'destination' and 'indices' must not overlap.
+inline void OptimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount,
+                                size_t vertexCount, uint32_t cacheSize = 16)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    // vertex -> triangles adjacency (CSR)
+    DKArray<uint32_t> offsets, adjacency, liveTriangles;
+    offsets.Resize(vertexCount + 1);
+    liveTriangles.Resize(vertexCount);
+    adjacency.Resize(triangleCount * 3);
+    uint32_t* offs = offsets;
+    uint32_t* live = liveTriangles;
+    uint32_t* adj = adjacency;
+    memset(live, 0, sizeof(uint32_t) * vertexCount);
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+        live[indices[i]]++;
+    offs[0] = 0;
+    for (size_t v = 0; v < vertexCount; ++v)
+        offs[v + 1] = offs[v] + live[v];
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            uint32_t v = indices[t * 3 + k];
+            adj[offs[v + 1] - live[v]] = static_cast<uint32_t>(t);
+            live[v]--;
+        }
+    }
+    for (size_t v = 0; v < vertexCount; ++v)
+        live[v] = offs[v + 1] - offs[v];
+
+    DKArray<uint32_t> timestamps, deadEnd, candidates;
+    DKArray<uint8_t> emitted;
+    timestamps.Resize(vertexCount);
+    emitted.Resize(triangleCount);
+    uint32_t* ts = timestamps;
+    uint8_t* emit = emitted;
+    memset(ts, 0, sizeof(uint32_t) * vertexCount);
+    memset(emit, 0, triangleCount);
+    deadEnd.Reserve(indexCount);
+
+    uint32_t time = cacheSize + 1;
+    size_t cursor = 0;      // next vertex to try when the dead-end stack is empty
+    size_t output = 0;
+    int64_t fanning = indices[0];
+
+    while (fanning >= 0)
+    {
+        candidates.Clear();
+        const uint32_t f = static_cast<uint32_t>(fanning);
+        for (uint32_t a = offs[f]; a < offs[f + 1]; ++a)
+        {
+            const uint32_t t = adj[a];
+            if (emit[t])
+                continue;
+            for (int k = 0; k < 3; ++k)
+            {
+                const uint32_t v = indices[t * 3 + k];
+                destination[output++] = v;
+                deadEnd.Add(v);
+                candidates.Add(v);
+                live[v]--;
+                if (time - ts[v] > cacheSize)
+                    ts[v] = time++;
+            }
+            emit[t] = 1;
+        }
+
+        // next fanning vertex: the candidate that stays longest in cache
+        // after its remaining triangles are emitted.
+        fanning = -1;
+        int64_t best = -1;
+        for (uint32_t v : candidates)
+        {
+            if (live[v] == 0)
+                continue;
+            int64_t priority = 0;
+            if (int64_t(time) - ts[v] + 2 * int64_t(live[v]) <= cacheSize)
+                priority = int64_t(time) - ts[v];
+            if (priority > best)
+            {
+                best = priority;
+                fanning = v;
+            }
+        }
+        if (fanning < 0)
+        {
+            while (!deadEnd.IsEmpty())
+            {
+                uint32_t d = deadEnd.Value(deadEnd.Count() - 1);
+                deadEnd.Remove(deadEnd.Count() - 1);
+                if (live[d] > 0)
+                {
+                    fanning = d;
+                    break;
+                }
+            }
+        }
+        if (fanning < 0)
+        {
+            while (cursor < vertexCount && live[cursor] == 0)
+                ++cursor;
+            if (cursor < vertexCount)
+                fanning = static_cast<int64_t>(cursor);
+        }
+    }
+    DKASSERT_DEBUG(output == triangleCount * 3);
+}
+
+// Splits the (cache optimized) triangle order into clusters and sorts the
+// clusters by how much they face outwards from the mesh center, drawing
+// likely occluders first. Clusters are split where the cache restarts and,
+// inside those, wherever the running ACMR is within 'threshold' of the
+// cluster's ACMR, so the cache efficiency lost by reordering stays small.
+// 'positions' points to the first position, 'stride' is the vertex size in bytes.
+inline void OptimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount,
+                             const float* positions, size_t stride, size_t vertexCount,
+                             float threshold = 1.05f, uint32_t cacheSize = 16)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    auto position = [positions, stride](uint32_t v)
+    {
+        const float* p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + stride * v);
+        return DKVector3(p[0], p[1], p[2]);
+    };
+
+    // per-triangle cache misses
+    DKArray<uint32_t> timestamps;
+    DKArray<uint8_t> misses;
+    timestamps.Resize(vertexCount);
+    misses.Resize(triangleCount);
+    uint32_t* ts = timestamps;
+    memset(ts, 0, sizeof(uint32_t) * vertexCount);
+    uint32_t time = cacheSize + 1;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        uint8_t m = 0;
+        for (int k = 0; k < 3; ++k)
+        {
+            uint32_t v = indices[t * 3 + k];
+            if (time - ts[v] > cacheSize)
+            {
+                ts[v] = time++;
+                m++;
+            }
+        }
+        misses.Value(t) = m;
+    }
+
+    // hard boundaries: all three vertices missed.
+    DKArray<uint32_t> clusters;  // first triangle of each cluster
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        if (t == 0 || misses.Value(t) == 3)
+            clusters.Add(static_cast<uint32_t>(t));
+    }
+    // soft boundaries inside hard clusters. each soft cluster starts with a
+    // cold cache, as it will after sorting, so it is only split off once it
+    // is long enough to amortize that.
+    DKArray<uint32_t> softClusters;
+    memset(ts, 0, sizeof(uint32_t) * vertexCount);
+    time = cacheSize + 1;
+    for (size_t c = 0; c < clusters.Count(); ++c)
+    {
+        const uint32_t begin = clusters.Value(c);
+        const uint32_t end = c + 1 < clusters.Count() ? clusters.Value(c + 1) : uint32_t(triangleCount);
+        uint32_t total = 0;
+        for (uint32_t t = begin; t < end; ++t)
+            total += misses.Value(t);
+        const float clusterAcmr = float(total) / float(end - begin);
+
+        softClusters.Add(begin);
+        time += cacheSize + 1;  // flush cache
+        uint32_t start = begin;
+        uint32_t running = 0;
+        for (uint32_t t = begin; t < end; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t v = indices[t * 3 + k];
+                if (time - ts[v] > cacheSize)
+                {
+                    ts[v] = time++;
+                    running++;
+                }
+            }
+            if (t + 1 < end && float(running) / float(t + 1 - start) <= clusterAcmr * threshold)
+            {
+                softClusters.Add(t + 1);
+                time += cacheSize + 1;
+                start = t + 1;
+                running = 0;
+            }
+        }
+    }
+
+    // mesh centroid
+    DKVector3 meshCenter(0, 0, 0);
+    float meshArea = 0.0f;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        DKVector3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+        float area = DKVector3::Cross(p1 - p0, p2 - p0).Length();
+        meshCenter = meshCenter + (p0 + p1 + p2) * (area / 3.0f);
+        meshArea += area;
+    }
+    if (meshArea > 0.0f)
+        meshCenter = meshCenter * (1.0f / meshArea);
+
+    struct ClusterSort
+    {
+        float key;
+        uint32_t begin;
+        uint32_t end;
+    };
+    DKArray<ClusterSort> sorted;
+    sorted.Reserve(softClusters.Count());
+    for (size_t c = 0; c < softClusters.Count(); ++c)
+    {
+        const uint32_t begin = softClusters.Value(c);
+        const uint32_t end = c + 1 < softClusters.Count() ? softClusters.Value(c + 1) : uint32_t(triangleCount);
+
+        DKVector3 center(0, 0, 0), normal(0, 0, 0);
+        float area = 0.0f;
+        for (uint32_t t = begin; t < end; ++t)
+        {
+            DKVector3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+            DKVector3 n = DKVector3::Cross(p1 - p0, p2 - p0);
+            float a = n.Length();
+            center = center + (p0 + p1 + p2) * (a / 3.0f);
+            normal = normal + n;
+            area += a;
+        }
+        if (area > 0.0f)
+            center = center * (1.0f / area);
+        normal.Normalize();
+        sorted.Add({ DKVector3::Dot(center - meshCenter, normal), begin, end });
+    }
+    std::stable_sort(&sorted.Value(0), &sorted.Value(0) + sorted.Count(),
+                     [](const ClusterSort& a, const ClusterSort& b) { return a.key > b.key; });
+
+    size_t output = 0;
+    for (const ClusterSort& c : sorted)
+    {
+        const size_t count = (c.end - c.begin) * 3;
+        memcpy(destination + output, indices + c.begin * 3, count * sizeof(uint32_t));
+        output += count;
+    }
+}
+
+// Reorders vertices in the order the indices first reference them, and
+// remaps indices in place. Unreferenced vertices are dropped.
+// Returns new vertex count.
+inline size_t OptimizeVertexFetch(void* vertices, uint32_t* indices, size_t indexCount,
+                                  size_t vertexCount, size_t vertexSize)
+{
+    const uint32_t unused = ~uint32_t(0);
+    DKArray<uint32_t> remap;
+    remap.Resize(vertexCount);
+    uint32_t* r = remap;
+    memset(r, 0xff, sizeof(uint32_t) * vertexCount);
+
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        uint32_t& v = r[indices[i]];
+        if (v == unused)
+            v = next++;
+        indices[i] = v;
+    }
+
+    DKArray<uint8_t> copy;
+    copy.Resize(vertexCount * vertexSize);
+    memcpy(copy, vertices, vertexCount * vertexSize);
+    const uint8_t* src = copy;
+    uint8_t* dst = reinterpret_cast<uint8_t*>(vertices);
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        if (r[v] != unused)
+            memcpy(dst + size_t(r[v]) * vertexSize, src + v * vertexSize, vertexSize);
+    }
+    return next;
+}
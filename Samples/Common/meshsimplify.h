@@ -0,0 +1,518 @@
+#pragma once
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <DK.h>
+
+// Quadric error metric (Garland & Heckbert) of a set of weighted planes.
+struct SimplifyQuadric
+{
+    double a00, a01, a02, a03;
+    double a11, a12, a13;
+    double a22, a23;
+    double a33;
+    double weight;  // total weight of surface planes
+
+    // plane: n.p + d = 0, with unit n.
+    // Constraint planes (surfaceWeight false) don't count in the average.
+    void AddPlane(double nx, double ny, double nz, double d, double w, bool surfaceWeight = true)
+    {
+        a00 += w * nx * nx; a01 += w * nx * ny; a02 += w * nx * nz; a03 += w * nx * d;
+        a11 += w * ny * ny; a12 += w * ny * nz; a13 += w * ny * d;
+        a22 += w * nz * nz; a23 += w * nz * d;
+        a33 += w * d * d;
+        if (surfaceWeight)
+            weight += w;
+    }
+    void Add(const SimplifyQuadric& q)
+    {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+    }
+    // weighted mean squared distance from p to the planes
+    double Error(const float* p) const
+    {
+        const double x = p[0], y = p[1], z = p[2];
+        double e = a00 * x * x + a11 * y * y + a22 * z * z + a33
+            + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z + a03 * x + a13 * y + a23 * z);
+        return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+    }
+};
+
+// Reduces a triangle list to about 'targetIndexCount' indices by moving
+// vertices onto neighbours (half-edge collapses), lowest quadric error first.
+// The result uses a subset of the input vertices, so levels of detail can
+// share one vertex buffer.
+// Vertices at the same position (texture seams) are collapsed together and
+// only along the seam, so seams neither open nor drift off the surface.
+// Open borders collapse only along the border. Vertices shared by triangles
+// of different 'triangleGroups' (e.g. submeshes, may be null) don't move.
+// No collapse exceeds 'maxError' (object space distance).
+// Triangles keep their order; their groups are written to 'dstGroups' if not
+// null. Returns the number of indices written to 'dst' (at most numIndices).
+inline size_t SimplifyMesh(uint32_t* dst, const uint32_t* indices, size_t numIndices,
+                           const float* positions, size_t stride, size_t numVertices,
+                           const uint32_t* triangleGroups, uint32_t* dstGroups,
+                           size_t targetIndexCount, float maxError, float* resultError = nullptr)
+{
+    auto position = [&](uint32_t v)
+    {
+        return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + v * stride);
+    };
+    auto normal = [](const float* p0, const float* p1, const float* p2, double n[3])
+    {
+        const double e1[3] = { double(p1[0]) - p0[0], double(p1[1]) - p0[1], double(p1[2]) - p0[2] };
+        const double e2[3] = { double(p2[0]) - p0[0], double(p2[1]) - p0[1], double(p2[2]) - p0[2] };
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    };
+
+    size_t numTriangles = numIndices / 3;
+    DKArray<uint32_t> tris;
+    DKArray<uint32_t> groups;
+    tris.Add(indices, numTriangles * 3);
+    if (triangleGroups)
+        groups.Add(triangleGroups, numTriangles);
+    else
+        groups.Resize(numTriangles, 0);
+
+    // vertices with the same position make one collapse unit (wedges).
+    DKArray<uint32_t> wedges;
+    DKArray<uint32_t> wedgeOffsets;
+    DKArray<uint32_t> unitOf;
+    wedges.Resize(numVertices);
+    unitOf.Resize(numVertices);
+    for (uint32_t v = 0; v < numVertices; ++v)
+        wedges.Value(v) = v;
+    if (numVertices > 0)
+    {
+        uint32_t* w = wedges;
+        std::sort(w, w + numVertices, [&](uint32_t a, uint32_t b)
+        {
+            return memcmp(position(a), position(b), sizeof(float) * 3) < 0;
+        });
+    }
+    for (uint32_t i = 0; i < numVertices; ++i)
+    {
+        if (i == 0 || memcmp(position(wedges.Value(i)), position(wedges.Value(i - 1)), sizeof(float) * 3) != 0)
+            wedgeOffsets.Add(i);
+        unitOf.Value(wedges.Value(i)) = static_cast<uint32_t>(wedgeOffsets.Count() - 1);
+    }
+    const uint32_t numUnits = static_cast<uint32_t>(wedgeOffsets.Count());
+    wedgeOffsets.Add(static_cast<uint32_t>(numVertices));
+    auto unitPosition = [&](uint32_t u) { return position(wedges.Value(wedgeOffsets.Value(u))); };
+
+    // drop triangles without area (two corners at the same position).
+    if (true)
+    {
+        size_t count = 0;
+        for (size_t t = 0; t < numTriangles; ++t)
+        {
+            const uint32_t ua = unitOf.Value(tris.Value(t * 3));
+            const uint32_t ub = unitOf.Value(tris.Value(t * 3 + 1));
+            const uint32_t uc = unitOf.Value(tris.Value(t * 3 + 2));
+            if (ua == ub || ub == uc || uc == ua)
+                continue;
+            for (int k = 0; k < 3; ++k)
+                tris.Value(count * 3 + k) = tris.Value(t * 3 + k);
+            groups.Value(count) = groups.Value(t);
+            count++;
+        }
+        numTriangles = count;
+    }
+
+    enum : uint8_t
+    {
+        UnitLocked = 1,
+        UnitBorder = 2,
+        UnitSeam = 4,
+    };
+    DKArray<uint8_t> lockedUnits;
+    lockedUnits.Resize(numUnits, 0);
+    if (triangleGroups)
+    {
+        DKArray<uint32_t> owner;
+        owner.Resize(numUnits, ~0U);
+        for (size_t t = 0; t < numTriangles; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t& o = owner.Value(unitOf.Value(tris.Value(t * 3 + k)));
+                if (o == ~0U)
+                    o = groups.Value(t);
+                else if (o != groups.Value(t))
+                    lockedUnits.Value(unitOf.Value(tris.Value(t * 3 + k))) = UnitLocked;
+            }
+        }
+    }
+
+    DKArray<SimplifyQuadric> quadrics;
+    quadrics.Resize(numUnits);
+    memset((SimplifyQuadric*)quadrics, 0, sizeof(SimplifyQuadric) * numUnits);
+    for (size_t t = 0; t < numTriangles; ++t)
+    {
+        const uint32_t* tri = &tris.Value(t * 3);
+        const float* p0 = position(tri[0]);
+        double n[3];
+        normal(p0, position(tri[1]), position(tri[2]), n);
+        const double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length <= 0.0)
+            continue;
+        n[0] /= length; n[1] /= length; n[2] /= length;
+        const double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+        for (int k = 0; k < 3; ++k)
+            quadrics.Value(unitOf.Value(tri[k])).AddPlane(n[0], n[1], n[2], d, length * 0.5);
+    }
+
+    struct Edge
+    {
+        uint64_t units;     // (min << 32) | max
+        uint64_t vertices;  // (min << 32) | max
+        uint32_t triangle;
+        uint32_t corner;
+    };
+    enum : uint8_t { EdgeManifold, EdgeBorder, EdgeSeam };
+    struct UniqueEdge
+    {
+        uint32_t u0, u1;
+        uint8_t kind;
+    };
+    struct Collapse
+    {
+        float cost;
+        uint32_t from;
+        uint32_t to;
+    };
+    DKArray<Edge> edges;
+    DKArray<UniqueEdge> uniqueEdges;
+    DKArray<Collapse> collapses;
+    DKArray<uint8_t> unitFlags;
+    DKArray<uint8_t> borderEdges;   // border and seam edges per unit
+    DKArray<uint8_t> seamEdges;
+    DKArray<uint32_t> wedgesUsed;
+    DKArray<uint32_t> adjacencyOffsets;
+    DKArray<uint32_t> adjacency;
+    DKArray<uint8_t> touched;
+    DKArray<uint32_t> remap;
+    DKArray<uint32_t> mapping;
+
+    const size_t targetTriangles = targetIndexCount / 3;
+    const double maxErrorSq = double(maxError) * double(maxError);
+    double resultErrorSq = 0.0;
+
+    for (int pass = 0; numTriangles > targetTriangles; ++pass)
+    {
+        // classify edges of the current triangles.
+        edges.Clear();
+        edges.Reserve(numTriangles * 3);
+        for (uint32_t t = 0; t < numTriangles; ++t)
+        {
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                const uint32_t a = tris.Value(t * 3 + k);
+                const uint32_t b = tris.Value(t * 3 + (k + 1) % 3);
+                const uint32_t ua = unitOf.Value(a), ub = unitOf.Value(b);
+                Edge e;
+                e.units = (uint64_t(std::min(ua, ub)) << 32) | std::max(ua, ub);
+                e.vertices = (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+                e.triangle = t;
+                e.corner = k;
+                edges.Add(e);
+            }
+        }
+        if (edges.Count() > 0)
+        {
+            Edge* e = edges;
+            std::sort(e, e + edges.Count(), [](const Edge& a, const Edge& b)
+            {
+                return a.units < b.units || (a.units == b.units && a.vertices < b.vertices);
+            });
+        }
+
+        unitFlags.Resize(numUnits);
+        borderEdges.Resize(numUnits);
+        seamEdges.Resize(numUnits);
+        wedgesUsed.Resize(numUnits);
+        for (uint32_t u = 0; u < numUnits; ++u)
+        {
+            unitFlags.Value(u) = lockedUnits.Value(u);
+            borderEdges.Value(u) = 0;
+            seamEdges.Value(u) = 0;
+            wedgesUsed.Value(u) = 0;
+        }
+        remap.Resize(numVertices);
+        for (uint32_t v = 0; v < numVertices; ++v)
+            remap.Value(v) = ~0U;
+        for (uint32_t i = 0; i < numTriangles * 3; ++i)
+        {
+            const uint32_t v = tris.Value(i);
+            if (remap.Value(v) == ~0U)
+            {
+                remap.Value(v) = v;
+                wedgesUsed.Value(unitOf.Value(v))++;
+            }
+        }
+        for (uint32_t u = 0; u < numUnits; ++u)
+        {
+            if (wedgesUsed.Value(u) > 1)
+                unitFlags.Value(u) |= UnitSeam;
+        }
+
+        auto saturatingInc = [](uint8_t& c) { if (c < 255) c++; };
+        uniqueEdges.Clear();
+        for (size_t i = 0; i < edges.Count();)
+        {
+            size_t n = 1;
+            while (i + n < edges.Count() && edges.Value(i + n).units == edges.Value(i).units)
+                n++;
+            const Edge& edge = edges.Value(i);
+            const uint32_t u0 = uint32_t(edge.units >> 32), u1 = uint32_t(edge.units);
+            uint8_t kind = EdgeManifold;
+            if (n == 1)
+                kind = EdgeBorder;
+            else if (n == 2 && edges.Value(i + 1).vertices != edge.vertices)
+                kind = EdgeSeam;
+            else if (n > 2)
+            {
+                unitFlags.Value(u0) |= UnitLocked;
+                unitFlags.Value(u1) |= UnitLocked;
+            }
+
+            if (kind == EdgeBorder)
+            {
+                saturatingInc(borderEdges.Value(u0));
+                saturatingInc(borderEdges.Value(u1));
+                unitFlags.Value(u0) |= UnitBorder;
+                unitFlags.Value(u1) |= UnitBorder;
+            }
+            else if (kind == EdgeSeam)
+            {
+                saturatingInc(seamEdges.Value(u0));
+                saturatingInc(seamEdges.Value(u1));
+            }
+
+            if (pass == 0 && kind != EdgeManifold)
+            {
+                // keep borders and seams in place: planes through the edge,
+                // perpendicular to the triangles.
+                for (size_t j = i; j < i + n; ++j)
+                {
+                    const uint32_t* tri = &tris.Value(edges.Value(j).triangle * 3);
+                    const uint32_t k = edges.Value(j).corner;
+                    const float* pa = position(tri[k]);
+                    const float* pb = position(tri[(k + 1) % 3]);
+                    double tn[3];
+                    normal(pa, pb, position(tri[(k + 2) % 3]), tn);
+                    const double ev[3] = { double(pb[0]) - pa[0], double(pb[1]) - pa[1], double(pb[2]) - pa[2] };
+                    double pn[3] = { ev[1] * tn[2] - ev[2] * tn[1], ev[2] * tn[0] - ev[0] * tn[2], ev[0] * tn[1] - ev[1] * tn[0] };
+                    const double length = sqrt(pn[0] * pn[0] + pn[1] * pn[1] + pn[2] * pn[2]);
+                    if (length <= 0.0)
+                        continue;
+                    pn[0] /= length; pn[1] /= length; pn[2] /= length;
+                    const double d = -(pn[0] * pa[0] + pn[1] * pa[1] + pn[2] * pa[2]);
+                    const double w = (ev[0] * ev[0] + ev[1] * ev[1] + ev[2] * ev[2]) * 10.0;
+                    quadrics.Value(u0).AddPlane(pn[0], pn[1], pn[2], d, w, false);
+                    quadrics.Value(u1).AddPlane(pn[0], pn[1], pn[2], d, w, false);
+                }
+            }
+            uniqueEdges.Add({ u0, u1, kind });
+            i += n;
+        }
+        // units where borders or seams meet or branch can't move.
+        for (uint32_t u = 0; u < numUnits; ++u)
+        {
+            const uint8_t flags = unitFlags.Value(u);
+            if (((flags & UnitBorder) && (flags & UnitSeam)) ||
+                ((flags & UnitBorder) && borderEdges.Value(u) != 2) ||
+                ((flags & UnitSeam) && seamEdges.Value(u) != 2))
+                unitFlags.Value(u) |= UnitLocked;
+        }
+
+        // cheaper direction of each edge, seam and border units move along
+        // their seam or border only.
+        collapses.Clear();
+        for (const UniqueEdge& edge : uniqueEdges)
+        {
+            Collapse best = { 0, ~0U, ~0U };
+            for (int dir = 0; dir < 2; ++dir)
+            {
+                const uint32_t from = dir ? edge.u1 : edge.u0;
+                const uint32_t to = dir ? edge.u0 : edge.u1;
+                const uint8_t flags = unitFlags.Value(from);
+                if ((flags & UnitLocked) ||
+                    ((flags & UnitBorder) && edge.kind != EdgeBorder) ||
+                    ((flags & UnitSeam) && edge.kind != EdgeSeam))
+                    continue;
+                SimplifyQuadric q = quadrics.Value(from);
+                q.Add(quadrics.Value(to));
+                const float cost = static_cast<float>(q.Error(unitPosition(to)));
+                if (best.from == ~0U || cost < best.cost)
+                    best = { cost, from, to };
+            }
+            if (best.from != ~0U)
+                collapses.Add(best);
+        }
+        if (collapses.IsEmpty())
+            break;
+        if (true)
+        {
+            Collapse* c = collapses;
+            std::sort(c, c + collapses.Count(), [](const Collapse& a, const Collapse& b)
+            {
+                return a.cost < b.cost;
+            });
+        }
+
+        // vertex -> triangles
+        adjacencyOffsets.Resize(numVertices + 1);
+        for (uint32_t v = 0; v <= numVertices; ++v)
+            adjacencyOffsets.Value(v) = 0;
+        for (uint32_t i = 0; i < numTriangles * 3; ++i)
+            adjacencyOffsets.Value(tris.Value(i) + 1)++;
+        for (uint32_t v = 0; v < numVertices; ++v)
+            adjacencyOffsets.Value(v + 1) += adjacencyOffsets.Value(v);
+        adjacency.Resize(numTriangles * 3);
+        for (uint32_t t = 0; t < numTriangles; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+                adjacency.Value(adjacencyOffsets.Value(tris.Value(t * 3 + k))++) = t;
+        }
+        for (uint32_t v = numVertices; v > 0; --v)
+            adjacencyOffsets.Value(v) = adjacencyOffsets.Value(v - 1);
+        adjacencyOffsets.Value(0) = 0;
+
+        // collapse independent units, cheapest first.
+        touched.Resize(numUnits);
+        for (uint32_t u = 0; u < numUnits; ++u)
+            touched.Value(u) = 0;
+        size_t remaining = numTriangles;
+        size_t numCollapsed = 0;
+        for (const Collapse& c : collapses)
+        {
+            if (remaining <= targetTriangles || c.cost > maxErrorSq)
+                break;
+            if (touched.Value(c.from) || touched.Value(c.to))
+                continue;
+
+            // each wedge of 'from' must reach exactly one wedge of 'to',
+            // and different wedges different ones.
+            bool valid = true;
+            mapping.Clear();
+            for (uint32_t i = wedgeOffsets.Value(c.from); i < wedgeOffsets.Value(c.from + 1) && valid; ++i)
+            {
+                const uint32_t w = wedges.Value(i);
+                if (adjacencyOffsets.Value(w) == adjacencyOffsets.Value(w + 1))
+                    continue;
+                uint32_t target = ~0U;
+                for (uint32_t a = adjacencyOffsets.Value(w); a < adjacencyOffsets.Value(w + 1) && valid; ++a)
+                {
+                    const uint32_t* tri = &tris.Value(adjacency.Value(a) * 3);
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        if (unitOf.Value(tri[k]) != c.to)
+                            continue;
+                        if (target == ~0U)
+                            target = tri[k];
+                        else if (target != tri[k])
+                            valid = false;
+                    }
+                }
+                if (target == ~0U)
+                    valid = false;
+                for (size_t m = 1; m < mapping.Count() && valid; m += 2)
+                {
+                    if (mapping.Value(m) == target)
+                        valid = false;
+                }
+                mapping.Add(w);
+                mapping.Add(target);
+            }
+            if (!valid || mapping.IsEmpty())
+                continue;
+
+            // reject collapses that flip triangles.
+            const float* target = unitPosition(c.to);
+            size_t removed = 0;
+            for (size_t m = 0; m < mapping.Count() && valid; m += 2)
+            {
+                const uint32_t w = mapping.Value(m);
+                for (uint32_t a = adjacencyOffsets.Value(w); a < adjacencyOffsets.Value(w + 1) && valid; ++a)
+                {
+                    const uint32_t* tri = &tris.Value(adjacency.Value(a) * 3);
+                    const float* p[3];
+                    bool degenerate = false;
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        p[k] = position(tri[k]);
+                        if (unitOf.Value(tri[k]) == c.to)
+                            degenerate = true;
+                    }
+                    if (degenerate)
+                    {
+                        removed++;
+                        continue;
+                    }
+                    double n0[3], n1[3];
+                    normal(p[0], p[1], p[2], n0);
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        if (tri[k] == w)
+                            p[k] = target;
+                    }
+                    normal(p[0], p[1], p[2], n1);
+                    if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0)
+                        valid = false;
+                }
+            }
+            if (!valid)
+                continue;
+
+            for (size_t m = 0; m < mapping.Count(); m += 2)
+            {
+                const uint32_t w = mapping.Value(m);
+                remap.Value(w) = mapping.Value(m + 1);
+                for (uint32_t a = adjacencyOffsets.Value(w); a < adjacencyOffsets.Value(w + 1); ++a)
+                {
+                    const uint32_t* tri = &tris.Value(adjacency.Value(a) * 3);
+                    for (int k = 0; k < 3; ++k)
+                        touched.Value(unitOf.Value(tri[k])) = 1;
+                }
+            }
+            quadrics.Value(c.to).Add(quadrics.Value(c.from));
+            resultErrorSq = std::max(resultErrorSq, double(c.cost));
+            remaining -= std::min(removed, remaining);
+            numCollapsed++;
+        }
+        if (numCollapsed == 0)
+            break;
+
+        // remap and drop triangles that became degenerate.
+        size_t count = 0;
+        for (size_t t = 0; t < numTriangles; ++t)
+        {
+            const uint32_t a = remap.Value(tris.Value(t * 3));
+            const uint32_t b = remap.Value(tris.Value(t * 3 + 1));
+            const uint32_t c = remap.Value(tris.Value(t * 3 + 2));
+            const uint32_t ua = unitOf.Value(a), ub = unitOf.Value(b), uc = unitOf.Value(c);
+            if (ua == ub || ub == uc || uc == ua)
+                continue;
+            tris.Value(count * 3) = a;
+            tris.Value(count * 3 + 1) = b;
+            tris.Value(count * 3 + 2) = c;
+            groups.Value(count) = groups.Value(t);
+            count++;
+        }
+        numTriangles = count;
+    }
+
+    memcpy(dst, (const uint32_t*)tris, numTriangles * 3 * sizeof(uint32_t));
+    if (dstGroups)
+        memcpy(dstGroups, (const uint32_t*)groups, numTriangles * sizeof(uint32_t));
+    if (resultError)
+        *resultError = static_cast<float>(sqrt(resultErrorSq));
+    return numTriangles * 3;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <DK.h>
+
+// Mip level of an image stored with all its levels in one block.
+struct TextureMipLevel
+{
+    size_t offset;      // bytes from the first level
+    size_t length;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Number of levels of a full mip chain, down to 1x1.
+inline uint32_t MipLevelCount(uint32_t width, uint32_t height)
+{
+    uint32_t levels = 1;
+    while (width > 1 || height > 1)
+    {
+        width = std::max(width >> 1, 1U);
+        height = std::max(height >> 1, 1U);
+        levels++;
+    }
+    return levels;
+}
+
+// Box filters a RGBA8 image down to max(width/2, 1) x max(height/2, 1).
+// Odd sizes use 3 taps weighted by coverage, so the last row or column of
+// a non power of two image is not dropped.
+inline void DownsampleRGBA8(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst)
+{
+    struct Taps
+    {
+        uint32_t index[3];
+        float weight[3];
+        uint32_t count;
+    };
+    auto buildTaps = [](uint32_t size, DKArray<Taps>& taps)
+    {
+        const uint32_t n = std::max(size >> 1, 1U);
+        taps.Resize(n);
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            if (size == 1)
+                taps.Value(i) = { { 0, 0, 0 }, { 1.0f, 0.0f, 0.0f }, 1 };
+            else if ((size & 1) == 0)
+                taps.Value(i) = { { 2 * i, 2 * i + 1, 0 }, { 0.5f, 0.5f, 0.0f }, 2 };
+            else
+                taps.Value(i) = { { 2 * i, 2 * i + 1, 2 * i + 2 },
+                                  { float(n - i) / size, float(n) / size, float(i + 1) / size }, 3 };
+        }
+    };
+    DKArray<Taps> tapsX, tapsY;
+    buildTaps(width, tapsX);
+    buildTaps(height, tapsY);
+
+    for (const Taps& ty : tapsY)
+    {
+        for (const Taps& tx : tapsX)
+        {
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (uint32_t j = 0; j < ty.count; ++j)
+            {
+                const uint8_t* row = src + size_t(ty.index[j]) * width * 4;
+                for (uint32_t i = 0; i < tx.count; ++i)
+                {
+                    const uint8_t* p = row + size_t(tx.index[i]) * 4;
+                    const float w = ty.weight[j] * tx.weight[i];
+                    sum[0] += w * p[0];
+                    sum[1] += w * p[1];
+                    sum[2] += w * p[2];
+                    sum[3] += w * p[3];
+                }
+            }
+            for (int c = 0; c < 4; ++c)
+                *dst++ = static_cast<uint8_t>(std::min(sum[c] + 0.5f, 255.0f));
+        }
+    }
+}
+
+// Copies a RGBA8 image to 'pixels' followed by its downsampled levels.
+// With 'mipmaps' false, only the image itself is stored.
+inline void BuildMipChainRGBA8(const void* image, uint32_t width, uint32_t height, bool mipmaps,
+                               DKArray<uint8_t>& pixels, DKArray<TextureMipLevel>& levels)
+{
+    const uint32_t levelCount = mipmaps ? MipLevelCount(width, height) : 1;
+    levels.Clear();
+    levels.Reserve(levelCount);
+    size_t length = 0;
+    for (uint32_t i = 0, w = width, h = height; i < levelCount; ++i)
+    {
+        levels.Add({ length, size_t(w) * h * 4, w, h });
+        length += size_t(w) * h * 4;
+        w = std::max(w >> 1, 1U);
+        h = std::max(h >> 1, 1U);
+    }
+    pixels.Resize(length);
+    uint8_t* p = pixels;
+    memcpy(p, image, levels.Value(0).length);
+    for (uint32_t i = 1; i < levelCount; ++i)
+    {
+        const TextureMipLevel& src = levels.Value(i - 1);
+        DownsampleRGBA8(p + src.offset, src.width, src.height, p + levels.Value(i).offset);
+    }
+}
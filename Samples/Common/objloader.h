@@ -0,0 +1,211 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <DK.h>
+
+#include "tiny_obj_loader.h"
+
+// Loads .obj file with worker threads.
+// The file is memory-mapped and split into newline-aligned chunks, each chunk
+// is parsed on its own thread with tinyobj::ParseObjChunk(), and the chunks are
+// combined in file order with tinyobj::LoadObjFromChunks().
+// The result is the same as tinyobj::LoadObj().
+inline bool LoadObjParallel(tinyobj::attrib_t* attrib,
+                            std::vector<tinyobj::shape_t>* shapes,
+                            std::vector<tinyobj::material_t>* materials,
+                            std::string* err,
+                            const char* filename,
+                            const char* mtlBaseDir = nullptr,
+                            uint32_t maxThreads = 0)
+{
+    DKObject<DKFileMap> fileMap = DKFileMap::Open(filename, 0, false);
+    if (fileMap == nullptr)
+    {
+        if (err)
+            *err = std::string("Cannot open file [") + filename + "]\n";
+        return false;
+    }
+
+    const char* data = reinterpret_cast<const char*>(fileMap->LockShared());
+    const size_t length = fileMap->Length();
+
+    if (maxThreads == 0)
+        maxThreads = std::max(std::thread::hardware_concurrency(), 1U);
+
+    // don't spawn threads for small files.
+    const size_t minChunkLength = 1 << 20;
+    const size_t numChunks = std::max<size_t>(std::min<size_t>(length / minChunkLength, maxThreads), 1);
+
+    DKArray<size_t> offsets;
+    offsets.Reserve(numChunks + 1);
+    offsets.Add(0);
+    for (size_t i = 1; i < numChunks; ++i)
+    {
+        size_t pos = std::max(length * i / numChunks, offsets.Value(i - 1));
+        while (pos < length && data[pos - 1] != '\n')
+            ++pos;
+        offsets.Add(pos);
+    }
+    offsets.Add(length);
+
+    std::vector<tinyobj::obj_chunk_t> chunks(numChunks);
+    auto parseChunk = [&](size_t i)
+    {
+        tinyobj::ParseObjChunk(&chunks[i], data + offsets.Value(i), offsets.Value(i + 1) - offsets.Value(i));
+    };
+
+    DKArray<DKObject<DKThread>> workers;
+    workers.Reserve(numChunks);
+    for (size_t i = 1; i < numChunks; ++i)
+    {
+        workers.Add(DKThread::Create(DKFunction([&parseChunk, i]()
+        {
+            parseChunk(i);
+        })->Invocation()));
+    }
+    parseChunk(0);
+    for (DKThread* thread : workers)
+        thread->WaitTerminate();
+
+    fileMap->UnlockShared();
+    fileMap = nullptr;
+
+    tinyobj::MaterialFileReader matFileReader(mtlBaseDir ? mtlBaseDir : "");
+    return tinyobj::LoadObjFromChunks(attrib, shapes, materials, err, chunks, &matFileReader);
+}
+
+// Loads 'filename' with tinyobj::LoadObj and LoadObjParallel, logs the
+// elapsed time of each and checks that both produce the same result.
+inline void BenchmarkObjLoader(const char* filename, int iterations = 3)
+{
+    auto sameResult = [](const tinyobj::attrib_t& a1, const std::vector<tinyobj::shape_t>& s1,
+                         const tinyobj::attrib_t& a2, const std::vector<tinyobj::shape_t>& s2)
+    {
+        if (a1.vertices != a2.vertices || a1.normals != a2.normals || a1.texcoords != a2.texcoords)
+            return false;
+        if (s1.size() != s2.size())
+            return false;
+        for (size_t i = 0; i < s1.size(); ++i)
+        {
+            const tinyobj::mesh_t& m1 = s1[i].mesh;
+            const tinyobj::mesh_t& m2 = s2[i].mesh;
+            if (s1[i].name != s2[i].name ||
+                m1.indices.size() != m2.indices.size() ||
+                m1.num_face_vertices != m2.num_face_vertices ||
+                m1.material_ids != m2.material_ids)
+                return false;
+            if (memcmp(m1.indices.data(), m2.indices.data(), m1.indices.size() * sizeof(tinyobj::index_t)))
+                return false;
+        }
+        return true;
+    };
+
+    double elapsed[2] = { 0.0, 0.0 };
+    bool identical = true;
+    DKTimer timer;
+    for (int i = 0; i < iterations; ++i)
+    {
+        tinyobj::attrib_t attrib[2];
+        std::vector<tinyobj::shape_t> shapes[2];
+        std::vector<tinyobj::material_t> materials[2];
+        std::string err[2];
+
+        timer.Reset();
+        tinyobj::LoadObj(&attrib[0], &shapes[0], &materials[0], &err[0], filename);
+        elapsed[0] += timer.Elapsed();
+
+        timer.Reset();
+        LoadObjParallel(&attrib[1], &shapes[1], &materials[1], &err[1], filename);
+        elapsed[1] += timer.Elapsed();
+
+        identical = identical && sameResult(attrib[0], shapes[0], attrib[1], shapes[1]);
+    }
+    DKLogI("ObjLoader benchmark: \"%s\" (%d iterations)", filename, iterations);
+    DKLogI("--> tinyobj::LoadObj: %.3fs", elapsed[0] / iterations);
+    DKLogI("--> LoadObjParallel: %.3fs (x%.2f, %u threads)",
+           elapsed[1] / iterations, elapsed[0] / std::max(elapsed[1], 1e-9),
+           std::thread::hardware_concurrency());
+    if (!identical)
+        DKLog(DKLogCategory::Error, "--> LoadObjParallel result mismatch!");
+}
+
+// Generates a synthetic .obj text of 'numLines' v/vn/vt lines in memory and
+// logs the time spent in tinyobj::ParseDouble (fast path and generic
+// conversion) and in tinyobj::ParseObjChunk for the whole text.
+inline void BenchmarkObjFloatParser(size_t numLines = 10000000)
+{
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    std::string text;
+    text.reserve(numLines * 36);
+    char line[128];
+    for (size_t i = 0; i < numLines; ++i)
+    {
+        switch (i % 5)
+        {
+        case 0: case 1: case 2:
+            snprintf(line, sizeof(line), "v %.6f %.6f %.6f\n", position(rng), position(rng), position(rng));
+            break;
+        case 3:
+            snprintf(line, sizeof(line), "vn %.6f %.6f %.6f\n", unit(rng), unit(rng), unit(rng));
+            break;
+        default:
+            snprintf(line, sizeof(line), "vt %.6f %.6f\n", unit(rng) * 0.5f + 0.5f, unit(rng) * 0.5f + 0.5f);
+            break;
+        }
+        text.append(line);
+    }
+
+    // parse every number of the text, returns number of values parsed.
+    auto parseNumbers = [&text](bool fast, double& sum)
+    {
+        size_t count = 0;
+        const char* p = text.data();
+        const char* end = p + text.size();
+        while (p < end)
+        {
+            while (*p != ' ') ++p; // skip keyword
+            while (*p == ' ')
+            {
+                const char* token = ++p;
+                while (*p != ' ' && *p != '\n') ++p;
+                double value = 0.0;
+                tinyobj::ParseDouble(token, p, &value, fast);
+                sum += value;
+                ++count;
+            }
+            ++p; // '\n'
+        }
+        return count;
+    };
+
+    double elapsed[3];
+    double sum[2] = { 0.0, 0.0 };
+    size_t numValues = 0;
+    DKTimer timer;
+
+    timer.Reset();
+    parseNumbers(false, sum[0]);
+    elapsed[0] = timer.Elapsed();
+
+    timer.Reset();
+    numValues = parseNumbers(true, sum[1]);
+    elapsed[1] = timer.Elapsed();
+
+    tinyobj::obj_chunk_t chunk;
+    timer.Reset();
+    tinyobj::ParseObjChunk(&chunk, text.data(), text.size());
+    elapsed[2] = timer.Elapsed();
+
+    DKLogI("ObjFloatParser benchmark: %zu lines, %zu values (%.1f MB)",
+           numLines, numValues, double(text.size()) / (1024.0 * 1024.0));
+    DKLogI("--> generic: %.3fs (%.1f M values/s)", elapsed[0], numValues / std::max(elapsed[0], 1e-9) * 1e-6);
+    DKLogI("--> fast path: %.3fs (%.1f M values/s, x%.2f)", elapsed[1], numValues / std::max(elapsed[1], 1e-9) * 1e-6,
+           elapsed[0] / std::max(elapsed[1], 1e-9));
+    DKLogI("--> ParseObjChunk: %.3fs (%.1f M lines/s)", elapsed[2], numLines / std::max(elapsed[2], 1e-9) * 1e-6);
+    DKLogI("--> checksum: %f / %f", sum[0], sum[1]);
+}
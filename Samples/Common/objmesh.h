@@ -0,0 +1,734 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <DK.h>
+
+#include "tiny_obj_loader.h"
+#include "objloader.h"
+#include "meshcache.h"
+#include "meshopt.h"
+#include "indexbuffer.h"
+#include "meshsimplify.h"
+
+// Open-addressing (linear probing) table used to weld mesh vertices.
+// Each unique key gets the next index in insertion order, so the index
+// returned by Weld() can be used directly as the welded vertex index.
+// Key must provide 'uint32_t Hash() const' and 'bool operator == (const Key&) const'.
+template <typename Key> class VertexWeldTable
+{
+public:
+    enum : uint32_t { InvalidIndex = ~uint32_t(0) };
+
+    VertexWeldTable() = default;
+
+    void Reserve(size_t count)
+    {
+        keys.Reserve(count);
+        size_t capacity = 16;
+        while (capacity < count * 2)
+            capacity <<= 1;
+        if (capacity > slots.Count())
+            Rehash(capacity);
+    }
+
+    // Single lookup-or-insert. Returns index of the key, 'inserted' is set
+    // to true if the key was not in the table.
+    uint32_t Weld(const Key& key, bool& inserted)
+    {
+        if ((keys.Count() + 1) * 2 > slots.Count())
+            Rehash(slots.Count() > 0 ? slots.Count() * 2 : 16);
+
+        const uint32_t hash = key.Hash();
+        const size_t mask = slots.Count() - 1;
+        Slot* s = slots;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask)
+        {
+            Slot& slot = s[i];
+            if (slot.index == InvalidIndex)
+            {
+                slot.hash = hash;
+                slot.index = static_cast<uint32_t>(keys.Count());
+                keys.Add(key);
+                inserted = true;
+                return slot.index;
+            }
+            if (slot.hash == hash && keys.Value(slot.index) == key)
+            {
+                inserted = false;
+                return slot.index;
+            }
+        }
+    }
+
+    size_t Count() const { return keys.Count(); }
+
+private:
+    struct Slot
+    {
+        uint32_t hash;
+        uint32_t index;
+    };
+
+    void Rehash(size_t capacity)
+    {
+        DKASSERT_DEBUG((capacity & (capacity - 1)) == 0);
+        DKArray<Slot> old = std::move(slots);
+        slots.Resize(capacity);
+        Slot* s = slots;
+        for (size_t i = 0; i < capacity; ++i)
+            s[i] = { 0, InvalidIndex };
+
+        const size_t mask = capacity - 1;
+        for (const Slot& slot : old)
+        {
+            if (slot.index == InvalidIndex)
+                continue;
+            size_t i = slot.hash & mask;
+            while (s[i].index != InvalidIndex)
+                i = (i + 1) & mask;
+            s[i] = slot;
+        }
+    }
+
+    DKArray<Slot> slots;
+    DKArray<Key> keys;
+};
+
+inline uint32_t HashWeldKey(const int32_t* v, size_t count)
+{
+    // FNV-1a over 32-bit words, followed by a final avalanche.
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < count; ++i)
+    {
+        h ^= static_cast<uint32_t>(v[i]);
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
+
+class SampleObjMesh
+{
+public:
+    struct Vertex
+    {
+        DKVector3 inPos;
+        DKVector3 inColor;
+        DKVector2 intexCoord;
+    };
+
+    // Vertex attributes quantized to the weld tolerance (0.0001).
+    // Corners that quantize to the same key are merged into one vertex.
+    struct QuantizedVertex
+    {
+        int32_t v[8];
+
+        static int32_t Quantize(float f)
+        {
+            return static_cast<int32_t>(std::floor(double(f) * 10000.0 + 0.5));
+        }
+        QuantizedVertex(const Vertex& vertex)
+        {
+            const float f[] = {
+                vertex.inPos.x, vertex.inPos.y, vertex.inPos.z,
+                vertex.inColor.x, vertex.inColor.y, vertex.inColor.z,
+                vertex.intexCoord.x, vertex.intexCoord.y };
+            for (int i = 0; i < 8; ++i)
+                v[i] = Quantize(f[i]);
+        }
+        uint32_t Hash() const { return HashWeldKey(v, 8); }
+        bool operator == (const QuantizedVertex& other) const
+        {
+            return memcmp(v, other.v, sizeof(v)) == 0;
+        }
+    };
+
+    // Vertex layouts for GPU vertex buffers, see BuildVertexBufferData().
+    enum VertexLayout
+    {
+        VertexLayoutFloat,      // Vertex, 32 bytes
+        VertexLayoutCompact,    // CompactVertex, 12 bytes
+    };
+
+    // Position as unorm16 relative to the aabb (w is padding, 3-component
+    // 16-bit vertex formats are not widely supported), texcoord as unorm16
+    // if all texcoords are in [0, 1], as half-float otherwise.
+    // The constant vertex color is not stored.
+    struct CompactVertex
+    {
+        uint16_t position[4];
+        uint16_t texCoord[2];
+
+        static uint16_t EncodeUnorm16(float f)
+        {
+            f = std::min(std::max(f, 0.0f), 1.0f);
+            return static_cast<uint16_t>(f * 65535.0f + 0.5f);
+        }
+        static uint16_t EncodeHalf(float f)
+        {
+            // round to nearest even, overflow to inf, underflow to subnormals.
+            uint32_t x;
+            memcpy(&x, &f, 4);
+            const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+            x &= 0x7fffffff;
+            if (x >= 0x7f800000) // inf, nan
+                return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+            if (x >= 0x477ff000) // overflow
+                return sign | 0x7c00;
+            if (x < 0x38800000) // subnormal or zero
+            {
+                if (x < 0x33000000)
+                    return sign;
+                const uint32_t shift = 126 - (x >> 23);  // 14...24
+                const uint32_t m = (x & 0x7fffff) | 0x800000;
+                uint32_t h = m >> shift;
+                const uint32_t rest = m & ((1u << shift) - 1);
+                const uint32_t half = 1u << (shift - 1);
+                if (rest > half || (rest == half && (h & 1)))
+                    h++;
+                return sign | static_cast<uint16_t>(h);
+            }
+            uint32_t h = ((x - 0x38000000) >> 13);
+            const uint32_t rest = x & 0x1fff;
+            if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+                h++;
+            return sign | static_cast<uint16_t>(h);
+        }
+    };
+
+    // Vertex buffer contents and matching pipeline vertex descriptor.
+    // Compact positions decode to [0, 1]; 'positionDecode' maps them back to
+    // object space and is meant to be applied before the model transform, so
+    // mesh.vert needs no changes. Compact layout reads the constant color
+    // from buffer index 1 (one Float3 per instance, see ConstantColor), the
+    // buffer needs a color for each instance index a draw can reach.
+    struct VertexBufferData
+    {
+        DKArray<uint8_t> data;
+        uint32_t stride;
+        DKVertexDescriptor descriptor;
+        DKAffineTransform3 positionDecode;
+    };
+    static DKVector3 ConstantColor() { return DKVector3(1.0f, 1.0f, 1.0f); }
+
+    static DKVertexDescriptor FloatVertexDescriptor()
+    {
+        DKVertexDescriptor descriptor;
+        descriptor.attributes = {
+            { DKVertexFormat::Float3, offsetof(Vertex, inPos), 0, 0 },
+            { DKVertexFormat::Float3, offsetof(Vertex, inColor), 0, 1 },
+            { DKVertexFormat::Float2, offsetof(Vertex, intexCoord), 0, 2 },
+        };
+        descriptor.layouts = {
+            { DKVertexStepRate::Vertex, sizeof(Vertex), 0 },
+        };
+        return descriptor;
+    }
+
+    // Vertices are written in the order of indexData->vertexRemap if given
+    // and not empty (see BuildIndexBufferData).
+    void BuildVertexBufferData(VertexLayout layout, VertexBufferData& out,
+                               const IndexBufferData* indexData = nullptr) const
+    {
+        const uint32_t* remap = nullptr;
+        size_t numVertices = vertices.Count();
+        if (indexData && !indexData->vertexRemap.IsEmpty())
+        {
+            remap = indexData->vertexRemap;
+            numVertices = indexData->vertexRemap.Count();
+        }
+        auto vertexAt = [&](size_t i) -> const Vertex&
+        {
+            return vertices.Value(remap ? remap[i] : i);
+        };
+
+        out.data.Clear();
+        out.positionDecode = DKAffineTransform3();
+        if (layout == VertexLayoutFloat)
+        {
+            out.stride = sizeof(Vertex);
+            if (remap)
+            {
+                out.data.Resize(numVertices * sizeof(Vertex));
+                Vertex* dst = reinterpret_cast<Vertex*>((uint8_t*)out.data);
+                for (size_t i = 0; i < numVertices; ++i)
+                    dst[i] = vertexAt(i);
+            }
+            else
+                out.data.Add(reinterpret_cast<const uint8_t*>((const Vertex*)vertices), numVertices * sizeof(Vertex));
+            out.descriptor = FloatVertexDescriptor();
+            return;
+        }
+
+        bool unormTexCoord = true;
+        for (const Vertex& v : vertices)
+        {
+            if (v.intexCoord.x < 0.0f || v.intexCoord.x > 1.0f ||
+                v.intexCoord.y < 0.0f || v.intexCoord.y > 1.0f)
+            {
+                unormTexCoord = false;
+                break;
+            }
+        }
+
+        DKVector3 origin(0, 0, 0), extent(0, 0, 0);
+        if (numVertices > 0)
+        {
+            origin = aabb.positionMin;
+            extent = aabb.positionMax - aabb.positionMin;
+        }
+        const DKVector3 scale(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                              extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                              extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+        out.stride = sizeof(CompactVertex);
+        out.data.Resize(numVertices * sizeof(CompactVertex));
+        CompactVertex* cv = reinterpret_cast<CompactVertex*>((uint8_t*)out.data);
+        for (size_t i = 0; i < numVertices; ++i)
+        {
+            const Vertex& v = vertexAt(i);
+            cv[i].position[0] = CompactVertex::EncodeUnorm16((v.inPos.x - origin.x) * scale.x);
+            cv[i].position[1] = CompactVertex::EncodeUnorm16((v.inPos.y - origin.y) * scale.y);
+            cv[i].position[2] = CompactVertex::EncodeUnorm16((v.inPos.z - origin.z) * scale.z);
+            cv[i].position[3] = 0;
+            if (unormTexCoord)
+            {
+                cv[i].texCoord[0] = CompactVertex::EncodeUnorm16(v.intexCoord.x);
+                cv[i].texCoord[1] = CompactVertex::EncodeUnorm16(v.intexCoord.y);
+            }
+            else
+            {
+                cv[i].texCoord[0] = CompactVertex::EncodeHalf(v.intexCoord.x);
+                cv[i].texCoord[1] = CompactVertex::EncodeHalf(v.intexCoord.y);
+            }
+        }
+        out.positionDecode = DKAffineTransform3(DKLinearTransform3().Scale(extent.x, extent.y, extent.z), origin);
+
+        out.descriptor.attributes = {
+            { DKVertexFormat::UShort4Normalized, offsetof(CompactVertex, position), 0, 0 },
+            { DKVertexFormat::Float3, 0, 1, 1 },
+            { unormTexCoord ? DKVertexFormat::UShort2Normalized : DKVertexFormat::Half2,
+              offsetof(CompactVertex, texCoord), 0, 2 },
+        };
+        out.descriptor.layouts = {
+            { DKVertexStepRate::Vertex, sizeof(CompactVertex), 0 },
+            { DKVertexStepRate::Instance, sizeof(DKVector3), 1 },
+        };
+    }
+
+    // Index buffer contents with one draw per submesh, 16-bit if possible.
+    // Meshes with more vertices than 16-bit indices can address are split
+    // into chunks with a base vertex each, unless 'allowSplit' is false.
+    void BuildIndexBufferData(IndexBufferData& out, bool allowSplit = true) const
+    {
+        DKArray<IndexedDraw> ranges;
+        ranges.Reserve(submeshes.Count());
+        for (const Submesh& submesh : submeshes)
+            ranges.Add({ submesh.indexStart, submesh.indexCount, 0, submesh.materialId });
+        ::BuildIndexBufferData(indices, indices.Count(), vertices.Count(),
+                               ranges, ranges.Count(), out, allowSplit);
+    }
+
+    SampleObjMesh()
+    {
+        vertices.Reserve(100);
+        indices.Reserve(100);
+    }
+
+    // OBJ corner (position, normal, texcoord) index triple.
+    struct IndexTriple
+    {
+        int32_t v[3];
+
+        IndexTriple(const tinyobj::index_t& index)
+            : v{ index.vertex_index, index.normal_index, index.texcoord_index }
+        {
+        }
+        uint32_t Hash() const { return HashWeldKey(v, 3); }
+        bool operator == (const IndexTriple& other) const
+        {
+            return v[0] == other.v[0] && v[1] == other.v[1] && v[2] == other.v[2];
+        }
+    };
+
+    // Range of indices drawn with one material.
+    typedef MeshCacheSubmesh Submesh;
+
+    enum LoadFlags : uint32_t
+    {
+        LoadFlagWeldAttributes = 1,
+        LoadFlagOptimize = 2,   // vertex cache, overdraw and vertex fetch order
+    };
+
+    // Loads mesh from InPath, or from its cache (MeshCachePath()) if the cache is
+    // up to date. The cache is (re)written after the .obj file is parsed.
+    void LoadFromObjFile(const char* InPath, uint32_t flags = LoadFlagWeldAttributes)
+    {
+        const std::string cachePath = MeshCachePath(InPath, flags);
+
+        MeshCacheKey cacheKey;
+        bool cacheable = GetMeshCacheKey(InPath, cacheKey);
+        if (cacheable && LoadFromCache(cachePath.c_str(), InPath, cacheKey, flags))
+        {
+            DKLog("Mesh loaded from cache: %s", cachePath.c_str());
+            return;
+        }
+
+        ParseObjFile(InPath, (flags & LoadFlagWeldAttributes) != 0);
+        if (flags & LoadFlagOptimize)
+            Optimize();
+
+        if (cacheable)
+        {
+            if (!WriteMeshCache(cachePath.c_str(), InPath, cacheKey, flags,
+                                vertices, GetVerticesCount(), sizeof(Vertex),
+                                indices, GetIndicesCount(),
+                                submeshes, static_cast<uint32_t>(submeshes.Count()),
+                                aabb))
+                DKLog("Failed to write mesh cache: %s", cachePath.c_str());
+        }
+    }
+
+    bool LoadFromCache(const char* cachePath, const char* sourcePath,
+                       const MeshCacheKey& key, uint32_t flags)
+    {
+        DKObject<DKFileMap> fileMap = DKFileMap::Open(cachePath, 0, false);
+        if (fileMap == nullptr)
+            return false;
+
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(fileMap->LockShared());
+        const MeshCacheHeader* header = ValidateMeshCache(data, fileMap->Length(),
+                                                          sourcePath, key, flags,
+                                                          sizeof(Vertex));
+        bool touched = false;
+        if (header)
+        {
+            touched = header->sourceTime != key.sourceTime;
+            vertices.Clear();
+            indices.Clear();
+            submeshes.Clear();
+            lods.Clear();
+            lodIndices.Clear();
+            lodSubmeshes.Clear();
+            vertices.Add(reinterpret_cast<const Vertex*>(data + header->vertexOffset), header->vertexCount);
+            indices.Add(reinterpret_cast<const uint32_t*>(data + header->indexOffset), header->indexCount);
+            submeshes.Add(reinterpret_cast<const Submesh*>(data + header->submeshOffset), header->submeshCount);
+            aabb = DKAabb();
+            aabb.Expand(DKVector3(header->aabbMin[0], header->aabbMin[1], header->aabbMin[2]));
+            aabb.Expand(DKVector3(header->aabbMax[0], header->aabbMax[1], header->aabbMax[2]));
+        }
+        fileMap->UnlockShared();
+        fileMap = nullptr;
+        // matched by content hash, store the new time to skip hashing next time.
+        if (touched && !UpdateCacheSourceTime(cachePath, offsetof(MeshCacheHeader, sourceTime), key))
+            DKLog("Failed to update mesh cache: %s", cachePath);
+        return header != nullptr;
+    }
+
+    // Corners are welded on their index triple first, which is exact and
+    // only touches three ints per corner. If weldAttributes is true, the
+    // resulting vertices are welded again on their quantized attributes to
+    // merge equal vertices that the file references through different
+    // indices (the output is then identical to a pure attribute weld).
+    void ParseObjFile(const char* InPath, bool weldAttributes)
+    {
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string err;
+        if (!LoadObjParallel(&attrib, &shapes, &materials, &err, InPath)) {
+            throw std::runtime_error(err);
+        }
+
+        // a mesh loaded again does not keep the last file's data.
+        vertices.Clear();
+        indices.Clear();
+        submeshes.Clear();
+        lods.Clear();
+        lodIndices.Clear();
+        lodSubmeshes.Clear();
+        aabb = DKAabb();
+
+        size_t numIndices = 0;
+        for (const auto& shape : shapes)
+            numIndices += shape.mesh.indices.size();
+
+        VertexWeldTable<IndexTriple> uniqueCorners;
+        uniqueCorners.Reserve(numIndices);
+        indices.Reserve(numIndices);
+
+        DKLog("Save to Container");
+        for (const auto& shape : shapes)
+        {
+            const tinyobj::index_t* index = shape.mesh.indices.data();
+            for (size_t face = 0; face < shape.mesh.num_face_vertices.size(); ++face)
+            {
+                const int materialId = shape.mesh.material_ids[face];
+                if (submeshes.IsEmpty() || submeshes.Value(submeshes.Count() - 1).materialId != materialId)
+                    submeshes.Add({ static_cast<uint32_t>(indices.Count()), 0, materialId, 0 });
+                submeshes.Value(submeshes.Count() - 1).indexCount += shape.mesh.num_face_vertices[face];
+
+                for (int corner = 0; corner < shape.mesh.num_face_vertices[face]; ++corner, ++index)
+                {
+                    bool inserted;
+                    uint32_t vertexIndex = uniqueCorners.Weld(IndexTriple(*index), inserted);
+                    if (inserted)
+                    {
+                        Vertex vertex = {};
+
+                        vertex.inPos = {
+                            attrib.vertices[3 * index->vertex_index + 0],
+                            attrib.vertices[3 * index->vertex_index + 1],
+                            attrib.vertices[3 * index->vertex_index + 2]
+                        };
+
+                        if (attrib.texcoords.size() && index->texcoord_index >= 0)
+                        {
+                            vertex.intexCoord = {
+                            attrib.texcoords[2 * index->texcoord_index + 0],
+                            1.0f - attrib.texcoords[2 * index->texcoord_index + 1]
+                            };
+                        }
+
+                        vertex.inColor = { 1.0f, 1.0f, 1.0f };
+
+                        vertices.Add(vertex);
+
+                        aabb.Expand(vertex.inPos);
+                    }
+                    indices.Add(vertexIndex);
+                }
+            }
+        }
+
+        if (weldAttributes)
+            WeldVertices();
+    }
+
+    // Merge vertices whose attributes are equal within the weld tolerance.
+    // Keeps first-seen order, so welding an already welded mesh is a no-op.
+    void WeldVertices()
+    {
+        const size_t numVertices = vertices.Count();
+
+        VertexWeldTable<QuantizedVertex> uniqueVertices;
+        uniqueVertices.Reserve(numVertices);
+
+        DKArray<uint32_t> remap;
+        remap.Resize(numVertices);
+
+        Vertex* v = vertices;
+        uint32_t* r = remap;
+        size_t count = 0;
+        for (size_t i = 0; i < numVertices; ++i)
+        {
+            bool inserted;
+            r[i] = uniqueVertices.Weld(QuantizedVertex(v[i]), inserted);
+            if (inserted)
+                v[count++] = v[i];
+        }
+        if (count == numVertices)
+            return;
+
+        vertices.Resize(count);
+        uint32_t* idx = indices;
+        for (size_t i = 0, n = indices.Count(); i < n; ++i)
+            idx[i] = r[idx[i]];
+    }
+
+    // Reorders triangles of each submesh for the post-transform cache and
+    // for less overdraw, then reorders vertices in first-use order.
+    // Returns ACMR/ATVR of the whole mesh before and after.
+    void Optimize(VertexCacheStats* before = nullptr, VertexCacheStats* after = nullptr)
+    {
+        if (before)
+            *before = AnalyzeVertexCache(indices, indices.Count(), vertices.Count());
+        if (after)
+            *after = {};
+        if (indices.IsEmpty())
+            return;
+
+        DKArray<uint32_t> reordered;
+        reordered.Resize(indices.Count());
+        for (const Submesh& submesh : submeshes)
+        {
+            uint32_t* idx = &indices.Value(submesh.indexStart);
+            uint32_t* tmp = &reordered.Value(submesh.indexStart);
+            OptimizeVertexCache(tmp, idx, submesh.indexCount, vertices.Count());
+            OptimizeOverdraw(idx, tmp, submesh.indexCount,
+                             &vertices.Value(0).inPos.x, sizeof(Vertex), vertices.Count());
+        }
+        size_t count = OptimizeVertexFetch(vertices, indices, indices.Count(), vertices.Count(), sizeof(Vertex));
+        vertices.Resize(count);
+
+        if (after)
+            *after = AnalyzeVertexCache(indices, indices.Count(), vertices.Count());
+    }
+
+    // Level of detail. LOD 0 is the mesh itself, the others are built by
+    // BuildLods() and use the same vertices. 'indexStart' of LOD 1 and up
+    // counts from the end of the LOD 0 indices, so uploading the mesh
+    // indices followed by GetLodIndicesData() gives one buffer for all LODs.
+    struct Lod
+    {
+        uint32_t indexStart;
+        uint32_t indexCount;
+        uint32_t submeshStart;  // LOD 0: GetSubmeshData(), others: GetLodSubmeshData()
+        uint32_t submeshCount;
+        float error;            // object space distance from LOD 0
+    };
+
+    // Builds up to 'maxLods' LODs (including LOD 0), each simplified from
+    // the previous one to about 'reduction' of its triangles. Stops early
+    // below 'minTriangles', when the error would exceed 'maxError' times
+    // the bounding box diagonal, or when the mesh can't be reduced further.
+    void BuildLods(uint32_t maxLods = 8, float reduction = 0.5f,
+                   uint32_t minTriangles = 128, float maxError = 0.05f)
+    {
+        lods.Clear();
+        lodIndices.Clear();
+        lodSubmeshes.Clear();
+        lods.Add({ 0, static_cast<uint32_t>(indices.Count()), 0, static_cast<uint32_t>(submeshes.Count()), 0.0f });
+        if (indices.IsEmpty())
+            return;
+
+        const float errorLimit = (aabb.positionMax - aabb.positionMin).Length() * maxError;
+
+        DKArray<uint32_t> source, sourceGroups, result, resultGroups;
+        source.Add(indices, indices.Count());
+        sourceGroups.Reserve(indices.Count() / 3);
+        for (uint32_t s = 0; s < submeshes.Count(); ++s)
+            sourceGroups.Resize(sourceGroups.Count() + submeshes.Value(s).indexCount / 3, s);
+
+        float error = 0.0f;
+        while (lods.Count() < maxLods)
+        {
+            const size_t sourceCount = source.Count();
+            const size_t target = size_t(double(sourceCount / 3) * reduction) * 3;
+            if (target / 3 < minTriangles || error >= errorLimit)
+                break;
+
+            result.Resize(sourceCount);
+            resultGroups.Resize(sourceCount / 3);
+            float stepError = 0.0f;
+            const size_t count = SimplifyMesh(result, source, sourceCount,
+                                              &vertices.Value(0).inPos.x, sizeof(Vertex), vertices.Count(),
+                                              sourceGroups, resultGroups,
+                                              target, errorLimit - error, &stepError);
+            // stalled (locked borders, error limit): less than half the reduction asked for
+            if (count == 0 || count > (sourceCount + target) / 2)
+                break;
+            error += stepError;
+
+            Lod lod = { static_cast<uint32_t>(indices.Count() + lodIndices.Count()),
+                        static_cast<uint32_t>(count),
+                        static_cast<uint32_t>(lodSubmeshes.Count()), 0, error };
+
+            // triangles keep their order, so each submesh is one run of groups.
+            lodIndices.Resize(lodIndices.Count() + count);
+            uint32_t* dst = &lodIndices.Value(lod.indexStart - indices.Count());
+            for (size_t t = 0, numTriangles = count / 3; t < numTriangles; )
+            {
+                const uint32_t group = resultGroups.Value(t);
+                size_t end = t + 1;
+                while (end < numTriangles && resultGroups.Value(end) == group)
+                    ++end;
+                OptimizeVertexCache(dst + t * 3, &result.Value(t * 3), (end - t) * 3, vertices.Count());
+                lodSubmeshes.Add({ lod.indexStart + static_cast<uint32_t>(t * 3),
+                                   static_cast<uint32_t>((end - t) * 3),
+                                   submeshes.Value(group).materialId, 0 });
+                t = end;
+            }
+            lod.submeshCount = static_cast<uint32_t>(lodSubmeshes.Count()) - lod.submeshStart;
+            lods.Add(lod);
+
+            source.Clear();
+            source.Add(dst, count);
+            sourceGroups.Clear();
+            sourceGroups.Add(resultGroups, count / 3);
+        }
+    }
+
+    // Coarsest LOD whose error projects to at most 'maxPixelError' pixels
+    // on a render target 'viewportHeight' pixels high, for the mesh drawn
+    // with 'modelView' and a perspective 'projection' (DKCamera).
+    uint32_t SelectLod(const DKMatrix4& modelView, const DKMatrix4& projection,
+                       float viewportHeight, float maxPixelError = 1.0f) const
+    {
+        if (lods.Count() < 2)
+            return 0;
+
+        const DKVector3 c = (aabb.positionMin + aabb.positionMax) * 0.5f;
+        const DKMatrix4& m = modelView;
+        const DKVector3 center(c.x * m.m[0][0] + c.y * m.m[1][0] + c.z * m.m[2][0] + m.m[3][0],
+                               c.x * m.m[0][1] + c.y * m.m[1][1] + c.z * m.m[2][1] + m.m[3][1],
+                               c.x * m.m[0][2] + c.y * m.m[1][2] + c.z * m.m[2][2] + m.m[3][2]);
+        float scale = 0.0f;
+        for (int i = 0; i < 3; ++i)
+            scale = std::max(scale, DKVector3(m.m[i][0], m.m[i][1], m.m[i][2]).Length());
+
+        // nearest point of the bounding sphere; m[1][1] is cot(fovY / 2).
+        const float radius = (aabb.positionMax - aabb.positionMin).Length() * 0.5f * scale;
+        const float distance = std::max(center.Length() - radius, 1.0e-4f);
+        const float pixelsPerUnit = viewportHeight * 0.5f * projection.m[1][1] / distance;
+
+        for (uint32_t i = static_cast<uint32_t>(lods.Count()) - 1; i > 0; --i)
+        {
+            if (lods.Value(i).error * scale * pixelsPerUnit <= maxPixelError)
+                return i;
+        }
+        return 0;
+    }
+
+    uint32_t GetVerticesCount() const {
+        return static_cast<uint32_t>(vertices.Count()); };
+    uint32_t GetIndicesCount() const {
+        return static_cast<uint32_t>(indices.Count()); };
+    const Vertex* GetVerticesData() const {
+        return vertices; }
+    const uint32_t* GetIndicesData() const {
+        return indices; }
+    uint32_t GetSubmeshCount() const {
+        return static_cast<uint32_t>(submeshes.Count()); }
+    const Submesh* GetSubmeshData() const {
+        return submeshes; }
+    uint32_t GetLodCount() const {
+        return static_cast<uint32_t>(lods.Count()); }
+    const Lod* GetLodData() const {
+        return lods; }
+    uint32_t GetLodIndicesCount() const {
+        return static_cast<uint32_t>(lodIndices.Count()); }
+    const uint32_t* GetLodIndicesData() const {
+        return lodIndices; }
+    const Submesh* GetLodSubmeshData() const {
+        return lodSubmeshes; }
+
+    DKAabb aabb;
+private:
+    DKArray<Vertex> vertices;
+    DKArray<uint32_t> indices;
+    DKArray<Submesh> submeshes;
+    DKArray<Lod> lods;
+    DKArray<uint32_t> lodIndices;
+    DKArray<Submesh> lodSubmeshes;
+    DKSpinLock                  MeshLock;
+};
+
+// Logs ACMR/ATVR of the mesh in 'path' before and after SampleObjMesh::Optimize().
+inline void ReportMeshOptimization(const char* path)
+{
+    SampleObjMesh mesh;
+    mesh.ParseObjFile(path, true);
+    VertexCacheStats before, after;
+    DKTimer timer;
+    timer.Reset();
+    mesh.Optimize(&before, &after);
+    DKLogI("%s: %u vertices, %u triangles, optimized in %.3fs",
+           path, mesh.GetVerticesCount(), mesh.GetIndicesCount() / 3, timer.Elapsed());
+    DKLogI("--> ACMR: %.3f -> %.3f, ATVR: %.3f -> %.3f",
+           before.acmr, after.acmr, before.atvr, after.atvr);
+}
@@ -0,0 +1,256 @@
+#pragma once
+#include <fstream>
+#include <DK.h>
+
+#include "tiny_obj_loader.h"
+#include "objmesh.h"
+#include "staging.h"
+
+// Builds GPU vertex and index buffers directly from an .obj file.
+// The file is read line by line with tinyobj::LoadObjWithCallback(), face
+// corners are welded as they arrive (same result as SampleObjMesh with
+// weldAttributes), and finished blocks of vertices and indices are written
+// through a StagingBufferRing into device buffers that grow on the GPU.
+// Host memory holds the .obj attribute pools ('v', 'vt') and weld tables,
+// which OBJ indexing requires, plus one block of output; the expanded
+// vertex and index data never exist on the host as a whole.
+class StreamingObjMesh
+{
+public:
+    typedef SampleObjMesh::Vertex Vertex;
+    typedef SampleObjMesh::Submesh Submesh;
+
+    enum : uint32_t
+    {
+        VertexBlockCount = 16384,
+        IndexBlockCount = 65536,
+    };
+
+    StreamingObjMesh()
+        : device(nullptr)
+        , staging(nullptr)
+        , numNormals(0)
+        , vertexCount(0)
+        , indexCount(0)
+        , vertexCapacity(0)
+        , indexCapacity(0)
+        , materialId(-1)
+    {
+    }
+
+    bool LoadFromObjFile(const char* InPath, DKCommandQueue* queue,
+                         size_t stagingBufferLength = 1 << 20, uint32_t numStagingBuffers = 4)
+    {
+        std::ifstream file(InPath);
+        if (!file)
+        {
+            DKLog(DKLogCategory::Error, "Cannot open file: %s", InPath);
+            return false;
+        }
+
+        StagingBufferRing ring(queue, stagingBufferLength, numStagingBuffers);
+        staging = &ring;
+        device = queue->Device();
+
+        tinyobj::callback_t callback;
+        callback.vertex_cb = [](void* p, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z, tinyobj::real_t)
+        {
+            StreamingObjMesh* self = reinterpret_cast<StreamingObjMesh*>(p);
+            self->positions.Add(x);
+            self->positions.Add(y);
+            self->positions.Add(z);
+        };
+        callback.normal_cb = [](void* p, tinyobj::real_t, tinyobj::real_t, tinyobj::real_t)
+        {
+            reinterpret_cast<StreamingObjMesh*>(p)->numNormals++;
+        };
+        callback.texcoord_cb = [](void* p, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t)
+        {
+            StreamingObjMesh* self = reinterpret_cast<StreamingObjMesh*>(p);
+            self->texcoords.Add(x);
+            self->texcoords.Add(y);
+        };
+        callback.index_cb = [](void* p, tinyobj::index_t* indices, int numIndices)
+        {
+            reinterpret_cast<StreamingObjMesh*>(p)->AddFace(indices, numIndices);
+        };
+        callback.usemtl_cb = [](void* p, const char*, int materialId)
+        {
+            reinterpret_cast<StreamingObjMesh*>(p)->materialId = materialId;
+        };
+
+        std::string err;
+        tinyobj::MaterialFileReader matFileReader("");
+        bool result = tinyobj::LoadObjWithCallback(file, callback, this, &matFileReader, &err);
+        if (!err.empty())
+            DKLog("%s", err.c_str());
+
+        FlushVertexBlock();
+        FlushIndexBlock();
+        ring.Flush();
+        ring.WaitIdle();
+        staging = nullptr;
+
+        // release everything but the gpu buffers.
+        positions.Clear();
+        texcoords.Clear();
+        uniqueCorners = VertexWeldTable<SampleObjMesh::IndexTriple>();
+        uniqueVertices = VertexWeldTable<SampleObjMesh::QuantizedVertex>();
+        cornerRemap.Clear();
+        vertexBlock.Clear();
+        indexBlock.Clear();
+
+        DKLog("Mesh streamed: %s (%u vertices, %u indices)", InPath, vertexCount, indexCount);
+        return result;
+    }
+
+    DKGpuBuffer* VertexBuffer() const { return vertexBuffer; }
+    DKGpuBuffer* IndexBuffer() const { return indexBuffer; }
+    uint32_t GetVerticesCount() const { return vertexCount; }
+    uint32_t GetIndicesCount() const { return indexCount; }
+    uint32_t GetSubmeshCount() const {
+        return static_cast<uint32_t>(submeshes.Count()); }
+    const Submesh* GetSubmeshData() const {
+        return submeshes; }
+
+    DKAabb aabb;
+
+private:
+    // raw .obj index: 1-based, negative is relative to the end, 0 is missing.
+    static int ResolveIndex(int index, size_t count)
+    {
+        if (index > 0)
+            return index - 1;
+        if (index < 0)
+            return static_cast<int>(count) + index;
+        return -1;
+    }
+
+    void AddFace(const tinyobj::index_t* face, int numCorners)
+    {
+        const size_t numPositions = positions.Count() / 3;
+        const size_t numTexcoords = texcoords.Count() / 2;
+
+        // triangle fan, same order as tinyobj::LoadObj with triangulation.
+        for (int k = 2; k < numCorners; ++k)
+        {
+            const tinyobj::index_t* corners[3] = { &face[0], &face[k - 1], &face[k] };
+            uint32_t triangle[3];
+            bool valid = true;
+            for (int i = 0; i < 3 && valid; ++i)
+            {
+                tinyobj::index_t index;
+                index.vertex_index = ResolveIndex(corners[i]->vertex_index, numPositions);
+                index.normal_index = ResolveIndex(corners[i]->normal_index, numNormals);
+                index.texcoord_index = ResolveIndex(corners[i]->texcoord_index, numTexcoords);
+                if (index.vertex_index < 0 || size_t(index.vertex_index) >= numPositions)
+                    valid = false;
+                else
+                    triangle[i] = AddCorner(index);
+            }
+            if (!valid)
+                continue;
+
+            if (submeshes.IsEmpty() || submeshes.Value(submeshes.Count() - 1).materialId != materialId)
+                submeshes.Add({ indexCount + static_cast<uint32_t>(indexBlock.Count()), 0, materialId, 0 });
+            submeshes.Value(submeshes.Count() - 1).indexCount += 3;
+
+            indexBlock.Add(triangle, 3);
+            if (indexBlock.Count() >= IndexBlockCount)
+                FlushIndexBlock();
+        }
+    }
+
+    // Welds a corner on its index triple first, then on its attributes.
+    uint32_t AddCorner(const tinyobj::index_t& index)
+    {
+        bool inserted;
+        uint32_t corner = uniqueCorners.Weld(SampleObjMesh::IndexTriple(index), inserted);
+        if (!inserted)
+            return cornerRemap.Value(corner);
+
+        Vertex vertex = {};
+        const float* pos = &positions.Value(3 * index.vertex_index);
+        vertex.inPos = { pos[0], pos[1], pos[2] };
+        if (index.texcoord_index >= 0 && size_t(index.texcoord_index) < texcoords.Count() / 2)
+        {
+            const float* uv = &texcoords.Value(2 * index.texcoord_index);
+            vertex.intexCoord = { uv[0], 1.0f - uv[1] };
+        }
+        vertex.inColor = { 1.0f, 1.0f, 1.0f };
+
+        uint32_t vertexIndex = uniqueVertices.Weld(SampleObjMesh::QuantizedVertex(vertex), inserted);
+        cornerRemap.Add(vertexIndex);
+        if (inserted)
+        {
+            vertexBlock.Add(vertex);
+            aabb.Expand(vertex.inPos);
+            if (vertexBlock.Count() >= VertexBlockCount)
+                FlushVertexBlock();
+        }
+        return vertexIndex;
+    }
+
+    // Grows 'buffer' to hold at least 'required' bytes, existing contents
+    // are copied on the GPU in order with the staged uploads.
+    void Reserve(DKObject<DKGpuBuffer>& buffer, size_t& capacity, size_t used, size_t required)
+    {
+        if (required <= capacity)
+            return;
+        size_t newCapacity = std::max<size_t>(capacity * 2, staging->BufferLength());
+        while (newCapacity < required)
+            newCapacity *= 2;
+        DKObject<DKGpuBuffer> newBuffer = device->CreateBuffer(newCapacity, DKGpuBuffer::StorageModePrivate, DKCpuCacheModeReadWrite);
+        if (buffer)
+            staging->CopyBuffer(buffer, 0, newBuffer, 0, used);
+        buffer = newBuffer;
+        capacity = newCapacity;
+    }
+
+    void FlushVertexBlock()
+    {
+        if (vertexBlock.IsEmpty())
+            return;
+        const size_t offset = size_t(vertexCount) * sizeof(Vertex);
+        const size_t length = vertexBlock.Count() * sizeof(Vertex);
+        Reserve(vertexBuffer, vertexCapacity, offset, offset + length);
+        staging->Upload(vertexBuffer, offset, vertexBlock, length);
+        vertexCount += static_cast<uint32_t>(vertexBlock.Count());
+        vertexBlock.Clear();
+    }
+
+    void FlushIndexBlock()
+    {
+        if (indexBlock.IsEmpty())
+            return;
+        const size_t offset = size_t(indexCount) * sizeof(uint32_t);
+        const size_t length = indexBlock.Count() * sizeof(uint32_t);
+        Reserve(indexBuffer, indexCapacity, offset, offset + length);
+        staging->Upload(indexBuffer, offset, indexBlock, length);
+        indexCount += static_cast<uint32_t>(indexBlock.Count());
+        indexBlock.Clear();
+    }
+
+    DKGraphicsDevice* device;
+    StagingBufferRing* staging;
+
+    DKArray<float> positions;
+    DKArray<float> texcoords;
+    size_t numNormals;  // normals are not used, only counted for relative indices
+    VertexWeldTable<SampleObjMesh::IndexTriple> uniqueCorners;
+    VertexWeldTable<SampleObjMesh::QuantizedVertex> uniqueVertices;
+    DKArray<uint32_t> cornerRemap;  // unique corner -> welded vertex
+
+    DKArray<Vertex> vertexBlock;
+    DKArray<uint32_t> indexBlock;
+
+    DKObject<DKGpuBuffer> vertexBuffer;
+    DKObject<DKGpuBuffer> indexBuffer;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    size_t vertexCapacity;
+    size_t indexCapacity;
+
+    DKArray<Submesh> submeshes;
+    int materialId;
+};
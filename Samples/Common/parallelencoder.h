@@ -0,0 +1,207 @@
+#pragma once
+#include <thread>
+#include <algorithm>
+#include <DK.h>
+#include "commandpool.h"
+
+// Encodes the draws of a render pass on worker threads.
+// DKGL has no parallel (secondary) render encoders, so every chunk of
+// draws gets a command buffer of its own, with a render pass that loads
+// the attachments stored by the previous chunk. Commit() commits them in
+// chunk order, the queue executes them in that order and the frame is the
+// same as if it was drawn with one encoder.
+// Every chunk after the first costs a render pass that stores and loads the
+// attachments (a full framebuffer round trip on tiled GPUs), so it pays off
+// only for draw lists far longer than 'minDrawsPerChunk'; one encoder on the
+// render thread is faster otherwise.
+//
+//   if (parallelEncoder.Encode(commandBuffers, rpd, numDraws, [&](DKRenderCommandEncoder* encoder, uint32_t first, uint32_t count)
+//   {
+//       ... set states, draw 'count' draws from 'first'
+//   }))
+//       parallelEncoder.Commit(commandBuffers);
+class ParallelRenderEncoder
+{
+public:
+    // 'numWorkers' 0 for one less than the number of processors, the
+    // calling thread encodes the first chunk.
+    ParallelRenderEncoder(uint32_t numWorkers = 0, uint32_t minDrawsPerChunk = 1024)
+        : minChunkLength(std::max(minDrawsPerChunk, 1U))
+        , running(true)
+        , pendingTasks(0)
+        , frames(0)
+        , totalChunks(0)
+        , totalEncodeTime(0.0)
+    {
+        if (numWorkers == 0)
+            numWorkers = std::max(std::thread::hardware_concurrency(), 2U) - 1;
+        for (uint32_t i = 0; i < numWorkers; ++i)
+            workers.Add(DKThread::Create(DKFunction(this, &ParallelRenderEncoder::WorkerThread)->Invocation()));
+    }
+
+    ~ParallelRenderEncoder()
+    {
+        condition.Lock();
+        running = false;
+        condition.Broadcast();
+        condition.Unlock();
+        for (DKThread* thread : workers)
+            thread->WaitTerminate();
+    }
+
+    // Splits 'count' draws in chunks and calls encode(encoder, first, count)
+    // for each chunk, concurrently. Returns false if a command buffer or an
+    // encoder could not be created, nothing is committed then.
+    template <typename EncodeFn>
+    bool Encode(CommandBufferPool& pool, const DKRenderPassDescriptor& rpd, uint32_t count, EncodeFn&& encode)
+    {
+        DKTimer timer;
+        timer.Reset();
+
+        const uint32_t numChunks = std::max(std::min<uint32_t>(count / minChunkLength, uint32_t(workers.Count()) + 1), 1U);
+        chunks.Clear();
+        chunks.Resize(numChunks);
+        for (uint32_t i = 0; i < numChunks; ++i)
+        {
+            Chunk& chunk = chunks.Value(i);
+            chunk.first = uint32_t(uint64_t(count) * i / numChunks);
+            chunk.count = uint32_t(uint64_t(count) * (i + 1) / numChunks) - chunk.first;
+            chunk.commandBuffer = pool.Acquire();
+            if (chunk.commandBuffer == nullptr)
+            {
+                chunks.Clear();
+                return false;
+            }
+            chunk.renderPass = rpd;
+            if (i > 0)
+            {
+                for (auto& color : chunk.renderPass.colorAttachments)
+                    color.loadAction = DKRenderPassAttachmentDescriptor::LoadActionLoad;
+                chunk.renderPass.depthStencilAttachment.loadAction = DKRenderPassAttachmentDescriptor::LoadActionLoad;
+            }
+            if (i + 1 < numChunks)
+            {
+                for (auto& color : chunk.renderPass.colorAttachments)
+                    color.storeAction = DKRenderPassAttachmentDescriptor::StoreActionStore;
+                chunk.renderPass.depthStencilAttachment.storeAction = DKRenderPassAttachmentDescriptor::StoreActionStore;
+            }
+        }
+
+        auto encodeChunk = [&](uint32_t i)
+        {
+            Chunk& chunk = chunks.Value(i);
+            DKObject<DKRenderCommandEncoder> encoder = chunk.commandBuffer->CreateRenderCommandEncoder(chunk.renderPass);
+            chunk.encoded = encoder != nullptr;
+            if (encoder)
+            {
+                encode(encoder, chunk.first, chunk.count);
+                encoder->EndEncoding();
+            }
+        };
+
+        condition.Lock();
+        for (uint32_t i = 1; i < numChunks; ++i)
+            tasks.Add(DKFunction([&encodeChunk, i]() { encodeChunk(i); })->Invocation());
+        pendingTasks += numChunks - 1;
+        condition.Broadcast();
+        condition.Unlock();
+
+        encodeChunk(0);
+
+        condition.Lock();
+        while (pendingTasks > 0)
+            condition.Wait();
+        condition.Unlock();
+
+        frames++;
+        totalChunks += numChunks;
+        totalEncodeTime += timer.Elapsed();
+
+        for (const Chunk& chunk : chunks)
+        {
+            if (!chunk.encoded)
+            {
+                chunks.Clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Command buffer of the last chunk, completes after all others.
+    DKCommandBuffer* LastCommandBuffer()
+    {
+        return chunks.IsEmpty() ? nullptr : (DKCommandBuffer*)chunks.Value(chunks.Count() - 1).commandBuffer;
+    }
+
+    // Commits the encoded command buffers in order, stops at the first one
+    // which fails (the chunks after it would load its attachments), so the
+    // last command buffer is committed only if all others are.
+    bool Commit(CommandBufferPool& pool)
+    {
+        bool result = !chunks.IsEmpty();
+        for (Chunk& chunk : chunks)
+        {
+            if (!pool.Commit(chunk.commandBuffer))
+            {
+                result = false;
+                break;
+            }
+        }
+        chunks.Clear();
+        return result;
+    }
+
+    void LogStats(const char* name) const
+    {
+        if (frames == 0)
+            return;
+        DKLog("%s parallel encoding: %u workers, %.2f chunks per frame, %.3fms per frame",
+              name, (uint32_t)workers.Count(), double(totalChunks) / frames, totalEncodeTime / frames * 1000.0);
+    }
+
+private:
+    struct Chunk
+    {
+        uint32_t first;
+        uint32_t count;
+        DKRenderPassDescriptor renderPass;
+        DKObject<DKCommandBuffer> commandBuffer;
+        bool encoded = false;
+    };
+
+    void WorkerThread()
+    {
+        condition.Lock();
+        while (running)
+        {
+            if (tasks.IsEmpty())
+            {
+                condition.Wait();
+                continue;
+            }
+            DKObject<DKOperation> task = tasks.Value(tasks.Count() - 1);
+            tasks.Remove(tasks.Count() - 1);
+            condition.Unlock();
+
+            task->Perform();
+
+            condition.Lock();
+            if (--pendingTasks == 0)
+                condition.Broadcast();
+        }
+        condition.Unlock();
+    }
+
+    const uint32_t minChunkLength;
+    DKArray<DKObject<DKThread>> workers;
+    DKArray<DKObject<DKOperation>> tasks;
+    DKArray<Chunk> chunks;
+    bool running;
+    uint32_t pendingTasks;
+    DKCondition condition;
+
+    uint64_t frames;
+    uint64_t totalChunks;
+    double totalEncodeTime;
+};
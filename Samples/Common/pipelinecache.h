@@ -0,0 +1,318 @@
+#pragma once
+#include <cstring>
+#include <unordered_map>
+#include <DK.h>
+
+#include "meshcache.h"
+
+// SPIR-V of a resource with its hash. The SPIR-V is parsed (a DKShader is
+// created) only when Shader() is called, PipelineCache calls it only to
+// create a module which is not cached for the hash yet.
+class CachedShader
+{
+public:
+    CachedShader(DKResourcePool& pool, const char* name)
+        : spirvHash(0)
+    {
+        data = pool.LoadResourceData(name);
+        if (data)
+        {
+            const void* p = data->LockShared();
+            spirvHash = HashMeshCacheData(p, data->Length());
+            data->UnlockShared();
+        }
+    }
+
+    DKData* Data() const { return data; }
+    uint64_t Hash() const { return spirvHash; }
+
+    DKShader* Shader()
+    {
+        if (shader == nullptr && data)
+            shader = DKOBJECT_NEW DKShader(data);
+        return shader;
+    }
+
+private:
+    DKObject<DKData> data;
+    uint64_t spirvHash;
+    DKObject<DKShader> shader;
+};
+
+// Shader modules and pipeline states of a device, created once per key.
+// Modules are keyed by a hash of their SPIR-V, pipelines by a hash of their
+// descriptor with shader functions replaced by the SPIR-V hash and function
+// name of their module, so identical pipelines are shared even if they are
+// requested with functions of different modules.
+//
+// Pipelines are kept for the lifetime of the cache only. DKGL does not
+// expose the driver pipeline cache (VkPipelineCache data, MTLBinaryArchive),
+// compiled pipelines are kept between runs by the driver's own shader cache.
+class PipelineCache
+{
+public:
+    struct Stats
+    {
+        uint32_t moduleHits;
+        uint32_t moduleMisses;
+        uint32_t pipelineHits;
+        uint32_t pipelineMisses;    // pipelines created
+        double createTime;          // of all pipelines created
+    };
+
+    PipelineCache(DKGraphicsDevice* dev)
+        : device(dev)
+        , stats()
+    {
+    }
+
+    // Function 'name' of 'shader', the first function if 'name' is null.
+    DKObject<DKShaderFunction> CreateShaderFunction(DKShader* shader, const char* name = nullptr)
+    {
+        const DKData* data = shader->Data();
+        if (data == nullptr)
+            return nullptr;
+        const void* spirv = data->LockShared();
+        const uint64_t moduleKey = HashMeshCacheData(spirv, data->Length());
+        data->UnlockShared();
+        return CreateShaderFunction(moduleKey, [shader]() { return shader; }, name);
+    }
+
+    // The SPIR-V of 'shader' is parsed only if its module is not cached.
+    DKObject<DKShaderFunction> CreateShaderFunction(CachedShader& shader, const char* name = nullptr)
+    {
+        if (shader.Data() == nullptr)
+            return nullptr;
+        return CreateShaderFunction(shader.Hash(), [&shader]() { return shader.Shader(); }, name);
+    }
+
+    DKObject<DKRenderPipelineState> CreateRenderPipeline(const DKRenderPipelineDescriptor& desc,
+                                                         DKPipelineReflection* reflection = nullptr)
+    {
+        KeyBuilder key;
+        key.Add(uint32_t(1));   // render pipeline
+        key.Add(FunctionKey(desc.vertexFunction));
+        key.Add(FunctionKey(desc.fragmentFunction));
+        for (const DKVertexAttributeDescriptor& attr : desc.vertexDescriptor.attributes)
+        {
+            key.Add(attr.format);
+            key.Add(attr.offset);
+            key.Add(attr.bufferIndex);
+            key.Add(attr.location);
+        }
+        for (const DKVertexBufferLayoutDescriptor& layout : desc.vertexDescriptor.layouts)
+        {
+            key.Add(layout.step);
+            key.Add(layout.stride);
+            key.Add(layout.bufferIndex);
+        }
+        for (const DKRenderPipelineColorAttachmentDescriptor& color : desc.colorAttachments)
+        {
+            key.Add(color.index);
+            key.Add(color.pixelFormat);
+            key.Add(color.blendState.enabled);
+            key.Add(color.blendState.sourceRGBBlendFactor);
+            key.Add(color.blendState.sourceAlphaBlendFactor);
+            key.Add(color.blendState.destinationRGBBlendFactor);
+            key.Add(color.blendState.destinationAlphaBlendFactor);
+            key.Add(color.blendState.rgbBlendOperation);
+            key.Add(color.blendState.alphaBlendOperation);
+            key.Add(color.blendState.writeMask);
+        }
+        key.Add(desc.depthStencilAttachmentPixelFormat);
+        key.Add(desc.depthStencilDescriptor.depthCompareFunction);
+        key.Add(desc.depthStencilDescriptor.depthWriteEnabled);
+        for (const DKStencilDescriptor* stencil : { &desc.depthStencilDescriptor.frontFaceStencil,
+                                                    &desc.depthStencilDescriptor.backFaceStencil })
+        {
+            key.Add(stencil->stencilCompareFunction);
+            key.Add(stencil->stencilFailureOperation);
+            key.Add(stencil->depthFailOperation);
+            key.Add(stencil->depthStencilPassOperation);
+            key.Add(stencil->readMask);
+            key.Add(stencil->writeMask);
+        }
+        key.Add(desc.primitiveTopology);
+        key.Add(desc.frontFace);
+        key.Add(desc.triangleFillMode);
+        key.Add(desc.depthClipMode);
+        key.Add(desc.cullMode);
+        key.Add(desc.rasterizationEnabled);
+
+        return CreatePipeline(renderPipelines, key.Hash(), reflection, [&](DKPipelineReflection* r)
+        {
+            return device->CreateRenderPipeline(desc, r);
+        });
+    }
+
+    DKObject<DKComputePipelineState> CreateComputePipeline(const DKComputePipelineDescriptor& desc,
+                                                           DKPipelineReflection* reflection = nullptr)
+    {
+        KeyBuilder key;
+        key.Add(uint32_t(2));   // compute pipeline
+        key.Add(FunctionKey(desc.computeFunction));
+
+        return CreatePipeline(computePipelines, key.Hash(), reflection, [&](DKPipelineReflection* r)
+        {
+            return device->CreateComputePipeline(desc, r);
+        });
+    }
+
+    Stats GetStats() const
+    {
+        condition.Lock();
+        Stats result = stats;
+        condition.Unlock();
+        return result;
+    }
+
+    void LogStats(const char* name) const
+    {
+        const Stats s = GetStats();
+        DKLog("%s pipeline cache: modules %u hits, %u misses; pipelines %u hits, %u misses, %.3fms created",
+              name, s.moduleHits, s.moduleMisses, s.pipelineHits, s.pipelineMisses, s.createTime * 1000.0);
+    }
+
+private:
+    // Descriptor bytes to hash.
+    struct KeyBuilder
+    {
+        DKArray<uint8_t> bytes;
+        template <typename T> void Add(const T& value)
+        {
+            bytes.Add(reinterpret_cast<const uint8_t*>(&value), sizeof(T));
+        }
+        uint64_t Hash() const { return HashMeshCacheData((const uint8_t*)bytes, bytes.Count()); }
+    };
+
+    template <typename T> struct Pipeline
+    {
+        DKObject<T> state;
+        DKPipelineReflection reflection;
+    };
+    template <typename T> using PipelineMap = std::unordered_map<uint64_t, Pipeline<T>>;
+
+    // getShader() is called only if the module of 'moduleKey' is not cached.
+    template <typename ShaderFn>
+    DKObject<DKShaderFunction> CreateShaderFunction(uint64_t moduleKey, ShaderFn&& getShader, const char* name)
+    {
+        DKObject<DKShaderModule> module;
+        condition.Lock();
+        auto m = modules.find(moduleKey);
+        if (m != modules.end())
+        {
+            module = m->second;
+            stats.moduleHits++;
+        }
+        condition.Unlock();
+        if (module == nullptr)
+        {
+            DKShader* shader = getShader();
+            if (shader == nullptr)
+                return nullptr;
+            module = device->CreateShaderModule(shader);
+            if (module == nullptr)
+                return nullptr;
+            condition.Lock();
+            auto result = modules.emplace(moduleKey, module);
+            module = result.first->second;  // created by another thread meanwhile
+            stats.moduleMisses++;
+            condition.Unlock();
+        }
+
+        DKString functionName;
+        if (name)
+            functionName = DKString(name);
+        else if (module->FunctionNames().Count() > 0)
+            functionName = module->FunctionNames().Value(0);
+        else
+            return nullptr;
+        DKStringU8 nameU8(functionName);
+        const char* nameBytes = (const char*)nameU8;
+        const uint64_t functionKey = Combine(moduleKey, HashMeshCacheData(nameBytes, strlen(nameBytes)));
+
+        condition.Lock();
+        auto f = functions.find(functionKey);
+        if (f != functions.end())
+        {
+            DKObject<DKShaderFunction> function = f->second;
+            condition.Unlock();
+            return function;
+        }
+        condition.Unlock();
+
+        DKObject<DKShaderFunction> function = module->CreateFunction(functionName);
+        if (function == nullptr)
+            return nullptr;
+        condition.Lock();
+        auto result = functions.emplace(functionKey, function);
+        function = result.first->second;
+        functionKeys[function] = functionKey;
+        condition.Unlock();
+        return function;
+    }
+
+    static uint64_t Combine(uint64_t a, uint64_t b)
+    {
+        return a ^ (b + 0x9e3779b97f4a7c15ULL + (a << 6) + (a >> 2));
+    }
+
+    // Functions not created by the cache are keyed by their address.
+    uint64_t FunctionKey(const DKShaderFunction* function) const
+    {
+        if (function == nullptr)
+            return 0;
+        condition.Lock();
+        auto it = functionKeys.find(function);
+        const uint64_t key = it != functionKeys.end() ? it->second : 0;
+        condition.Unlock();
+        if (key)
+            return key;
+        return reinterpret_cast<uintptr_t>(function);
+    }
+
+    template <typename T, typename CreateFn>
+    DKObject<T> CreatePipeline(PipelineMap<T>& pipelines, uint64_t key,
+                               DKPipelineReflection* reflection, CreateFn&& create)
+    {
+        condition.Lock();
+        auto it = pipelines.find(key);
+        if (it != pipelines.end())
+        {
+            DKObject<T> state = it->second.state;
+            if (reflection)
+                *reflection = it->second.reflection;
+            stats.pipelineHits++;
+            condition.Unlock();
+            return state;
+        }
+        condition.Unlock();
+
+        DKTimer timer;
+        timer.Reset();
+        Pipeline<T> pipeline;
+        pipeline.state = create(&pipeline.reflection);
+        const double elapsed = timer.Elapsed();
+        if (pipeline.state == nullptr)
+            return nullptr;
+        if (reflection)
+            *reflection = pipeline.reflection;
+
+        condition.Lock();
+        auto result = pipelines.emplace(key, pipeline);
+        DKObject<T> state = result.first->second.state;
+        stats.pipelineMisses++;
+        stats.createTime += elapsed;
+        condition.Unlock();
+        return state;
+    }
+
+    DKObject<DKGraphicsDevice> device;
+    std::unordered_map<uint64_t, DKObject<DKShaderModule>> modules;
+    std::unordered_map<uint64_t, DKObject<DKShaderFunction>> functions;
+    std::unordered_map<const DKShaderFunction*, uint64_t> functionKeys;
+    PipelineMap<DKRenderPipelineState> renderPipelines;
+    PipelineMap<DKComputePipelineState> computePipelines;
+    Stats stats;
+    mutable DKCondition condition;
+};
@@ -0,0 +1,219 @@
+#pragma once
+#include <algorithm>
+#include <DK.h>
+#include "pipelinecache.h"
+
+// Pipeline compiled by PipelineCompiler.
+// RenderPipeline() and ComputePipeline() are null until the pipeline is
+// compiled, Wait() blocks until then. A frame that finds the pipeline not
+// ready draws with a fallback pipeline or skips the draw.
+class PipelineRequest
+{
+public:
+    PipelineRequest() : done(false), succeeded(false), latency(0.0) {}
+
+    bool IsDone() const
+    {
+        condition.Lock();
+        bool result = done;
+        condition.Unlock();
+        return result;
+    }
+    // done, and the pipeline was created.
+    bool Succeeded() const
+    {
+        condition.Lock();
+        bool result = done && succeeded;
+        condition.Unlock();
+        return result;
+    }
+    DKRenderPipelineState* RenderPipeline() const
+    {
+        condition.Lock();
+        DKRenderPipelineState* result = done ? (DKRenderPipelineState*)renderPipeline : nullptr;
+        condition.Unlock();
+        return result;
+    }
+    DKComputePipelineState* ComputePipeline() const
+    {
+        condition.Lock();
+        DKComputePipelineState* result = done ? (DKComputePipelineState*)computePipeline : nullptr;
+        condition.Unlock();
+        return result;
+    }
+    // valid once done.
+    const DKPipelineReflection& Reflection() const { return reflection; }
+    // seconds from the request to the pipeline being ready.
+    double Latency() const { return latency; }
+
+    bool Wait() const
+    {
+        condition.Lock();
+        while (!done)
+            condition.Wait();
+        bool result = succeeded;
+        condition.Unlock();
+        return result;
+    }
+
+private:
+    friend class PipelineCompiler;
+    void Complete(bool result)
+    {
+        condition.Lock();
+        succeeded = result;
+        done = true;
+        condition.Broadcast();
+        condition.Unlock();
+    }
+
+    DKObject<DKOperation> task;
+    DKObject<DKRenderPipelineState> renderPipeline;
+    DKObject<DKComputePipelineState> computePipeline;
+    DKPipelineReflection reflection;
+    DKTimer timer;
+    bool done;
+    bool succeeded;
+    double latency;
+    mutable DKCondition condition;
+};
+
+// Compiles pipelines on worker threads, through a PipelineCache.
+// Compile*() returns a request immediately, the render loop polls it and
+// keeps drawing frames while pipelines are being compiled, so a new
+// pipeline never stalls a frame.
+class PipelineCompiler
+{
+public:
+    PipelineCompiler(PipelineCache& pipelineCache, uint32_t numWorkers = 1)
+        : cache(pipelineCache)
+        , running(true)
+        , requests(0)
+        , completed(0)
+        , failures(0)
+        , totalLatency(0.0)
+        , maxLatency(0.0)
+    {
+        for (uint32_t i = 0; i < std::max(numWorkers, 1U); ++i)
+            workers.Add(DKThread::Create(DKFunction(this, &PipelineCompiler::WorkerThread)->Invocation()));
+    }
+
+    ~PipelineCompiler()
+    {
+        condition.Lock();
+        running = false;
+        condition.Broadcast();
+        condition.Unlock();
+
+        for (DKThread* thread : workers)
+            thread->WaitTerminate();
+
+        // requests not started yet
+        for (PipelineRequest* request : pending)
+        {
+            request->task = nullptr;
+            request->Complete(false);
+        }
+    }
+
+    DKObject<PipelineRequest> CompileRenderPipeline(const DKRenderPipelineDescriptor& desc)
+    {
+        DKObject<PipelineRequest> request = DKOBJECT_NEW PipelineRequest();
+        PipelineRequest* r = request;
+        PipelineCache* c = &cache;
+        return Enqueue(request, DKFunction([r, c, desc]()
+        {
+            r->renderPipeline = c->CreateRenderPipeline(desc, &r->reflection);
+            r->succeeded = r->renderPipeline != nullptr;
+        })->Invocation());
+    }
+
+    DKObject<PipelineRequest> CompileComputePipeline(const DKComputePipelineDescriptor& desc)
+    {
+        DKObject<PipelineRequest> request = DKOBJECT_NEW PipelineRequest();
+        PipelineRequest* r = request;
+        PipelineCache* c = &cache;
+        return Enqueue(request, DKFunction([r, c, desc]()
+        {
+            r->computePipeline = c->CreateComputePipeline(desc, &r->reflection);
+            r->succeeded = r->computePipeline != nullptr;
+        })->Invocation());
+    }
+
+    // Pipelines created by other objects (DKMaterial), 'build' returns
+    // true if it succeeded.
+    template <typename BuildFn>
+    DKObject<PipelineRequest> Compile(BuildFn&& build)
+    {
+        DKObject<PipelineRequest> request = DKOBJECT_NEW PipelineRequest();
+        PipelineRequest* r = request;
+        return Enqueue(request, DKFunction([r, build]()
+        {
+            r->succeeded = build();
+        })->Invocation());
+    }
+
+    void LogStats(const char* name) const
+    {
+        condition.Lock();
+        DKLog("%s pipeline compiler: %u requests, %u failed, latency avg %.3fms max %.3fms",
+              name, requests, failures,
+              completed > 0 ? totalLatency / completed * 1000.0 : 0.0, maxLatency * 1000.0);
+        condition.Unlock();
+    }
+
+private:
+    DKObject<PipelineRequest> Enqueue(PipelineRequest* request, DKOperation* task)
+    {
+        request->task = task;
+        request->timer.Reset();
+        condition.Lock();
+        pending.Add(request);
+        requests++;
+        condition.Broadcast();
+        condition.Unlock();
+        return request;
+    }
+
+    void WorkerThread()
+    {
+        condition.Lock();
+        while (running)
+        {
+            if (pending.IsEmpty())
+            {
+                condition.Wait();
+                continue;
+            }
+            DKObject<PipelineRequest> request = pending.Value(0);
+            pending.Remove(0);
+            condition.Unlock();
+
+            // the task sets the pipeline and 'succeeded' before Complete() publishes them.
+            request->task->Perform();
+            request->task = nullptr;
+            request->latency = request->timer.Elapsed();
+            const bool succeeded = request->succeeded;
+
+            condition.Lock();
+            completed++;
+            if (!succeeded)
+                failures++;
+            totalLatency += request->latency;
+            maxLatency = std::max(maxLatency, request->latency);
+            request->Complete(succeeded);
+        }
+        condition.Unlock();
+    }
+
+    PipelineCache& cache;
+    DKArray<DKObject<DKThread>> workers;
+    DKArray<DKObject<PipelineRequest>> pending;
+    bool running;
+    uint32_t requests;
+    uint32_t completed;
+    uint32_t failures;
+    double totalLatency;
+    double maxLatency;
+    mutable DKCondition condition;
+};
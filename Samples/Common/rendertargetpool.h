@@ -0,0 +1,179 @@
+#pragma once
+#include <DK.h>
+
+// Transient render targets (depth buffers, intermediate attachments)
+// reused across passes and frames of one queue.
+// Acquire() returns a pooled texture with the same descriptor if there is
+// one not in use, Release() returns it to the pool once the last pass using
+// it is encoded. Use() ties a texture to a command buffer using it, the
+// texture is not acquired again before that command buffer has completed,
+// so frames in flight never share a target: a frame acquiring a target
+// still used by the GPU gets a texture of its own. Textures not used for
+// 'maxIdleFrames' frames, by the GPU either, are destroyed by NextFrame(),
+// so targets of old sizes do not pile up while a window is being resized.
+// Not thread safe, used by the render thread (completed handlers only
+// update the pending use count of a texture).
+class RenderTargetPool
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;    // textures created
+        uint64_t evictions;
+        uint32_t pooled;    // textures in the pool, in use or not
+        uint64_t pooledBytes;
+    };
+
+    RenderTargetPool(DKGraphicsDevice* dev, uint32_t idleFrames = 2)
+        : device(dev)
+        , maxIdleFrames(idleFrames)
+        , frame(0)
+        , stats()
+    {
+    }
+
+    DKObject<DKTexture> Acquire(const DKTextureDescriptor& desc)
+    {
+        for (Entry& entry : entries)
+        {
+            if (!entry.inUse && entry.pending->uses == 0 && Matches(entry.desc, desc))
+            {
+                entry.inUse = true;
+                stats.hits++;
+                return entry.texture;
+            }
+        }
+        DKObject<DKTexture> texture = device->CreateTexture(desc);
+        if (texture)
+        {
+            entries.Add({ texture, desc, frame, true, DKOBJECT_NEW PendingUses() });
+            stats.misses++;
+        }
+        return texture;
+    }
+
+    // 'commandBuffer' uses 'texture', call before committing it.
+    // The use ends when the command buffer completes, or when its handler
+    // is destroyed without being called (the buffer was not committed).
+    void Use(DKTexture* texture, DKCommandBuffer* commandBuffer)
+    {
+        for (Entry& entry : entries)
+        {
+            if (entry.texture == texture)
+            {
+                DKObject<PendingUse> use = DKOBJECT_NEW PendingUse(entry.pending);
+                commandBuffer->AddCompletedHandler(DKFunction([use]()
+                {
+                    use->End();
+                })->Invocation());
+                return;
+            }
+        }
+    }
+
+    // 'texture' can be acquired by passes encoded from now on, once the
+    // command buffers of Use() have completed.
+    void Release(DKTexture* texture)
+    {
+        for (Entry& entry : entries)
+        {
+            if (entry.texture == texture)
+            {
+                entry.inUse = false;
+                entry.lastUsedFrame = frame;
+                return;
+            }
+        }
+    }
+
+    void NextFrame()
+    {
+        frame++;
+        for (size_t i = 0; i < entries.Count(); )
+        {
+            Entry& entry = entries.Value(i);
+            if (entry.pending->uses > 0)
+                entry.lastUsedFrame = frame;    // idle frames count from the last frame the GPU used it
+            if (!entry.inUse && frame - entry.lastUsedFrame > maxIdleFrames)
+            {
+                entries.Remove(i);
+                stats.evictions++;
+            }
+            else
+                ++i;
+        }
+    }
+
+    Stats GetStats() const
+    {
+        Stats result = stats;
+        result.pooled = static_cast<uint32_t>(entries.Count());
+        result.pooledBytes = 0;
+        for (const Entry& entry : entries)
+        {
+            const DKTextureDescriptor& d = entry.desc;
+            result.pooledBytes += uint64_t(d.width) * d.height * d.depth * d.arrayLength * d.sampleCount *
+                                  DKPixelFormatBytesPerPixel(d.pixelFormat);
+        }
+        return result;
+    }
+
+    void LogStats(const char* name) const
+    {
+        const Stats s = GetStats();
+        DKLog("%s render targets: %llu hits, %llu misses, %llu evictions, %u pooled (%.2f MB)",
+              name, (unsigned long long)s.hits, (unsigned long long)s.misses, (unsigned long long)s.evictions,
+              s.pooled, double(s.pooledBytes) / (1 << 20));
+    }
+
+private:
+    // shared with completed handlers, which may run after the pool is destroyed.
+    struct PendingUses
+    {
+        DKAtomicNumber32 uses;
+    };
+    struct PendingUse
+    {
+        PendingUse(const DKObject<PendingUses>& p) : pending(p), ended(false) { pending->uses.Increment(); }
+        ~PendingUse() { End(); }
+        void End()
+        {
+            if (!ended)
+            {
+                ended = true;
+                pending->uses.Decrement();
+            }
+        }
+        DKObject<PendingUses> pending;
+        bool ended;
+    };
+
+    struct Entry
+    {
+        DKObject<DKTexture> texture;
+        DKTextureDescriptor desc;
+        uint64_t lastUsedFrame;
+        bool inUse;
+        DKObject<PendingUses> pending;  // committed command buffers using the texture
+    };
+
+    static bool Matches(const DKTextureDescriptor& a, const DKTextureDescriptor& b)
+    {
+        return a.textureType == b.textureType &&
+            a.pixelFormat == b.pixelFormat &&
+            a.width == b.width &&
+            a.height == b.height &&
+            a.depth == b.depth &&
+            a.mipmapLevels == b.mipmapLevels &&
+            a.sampleCount == b.sampleCount &&
+            a.arrayLength == b.arrayLength &&
+            a.usage == b.usage;
+    }
+
+    DKObject<DKGraphicsDevice> device;
+    const uint32_t maxIdleFrames;
+    uint64_t frame;
+    DKArray<Entry> entries;
+    Stats stats;
+};
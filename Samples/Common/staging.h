@@ -0,0 +1,284 @@
+#pragma once
+#include <cstring>
+#include <algorithm>
+#include <DK.h>
+
+// Ring of fixed-size host visible staging buffers used to upload data to
+// device buffers and textures in blocks.
+// Upload() copies data into the current staging buffer and records a copy
+// command. When the staging buffer is full (or on Flush), all its copy
+// commands are submitted with one command buffer and the next staging buffer
+// of the ring is used. A staging buffer is reused once the GPU has completed
+// its copies, Upload() blocks until then, so host memory used for uploading
+// stays at (bufferLength * numBuffers) regardless of the amount of data.
+// Keep one ring for the lifetime of a queue, uploads then cost a copy into
+// a mapped buffer instead of creating a buffer each.
+class StagingBufferRing
+{
+public:
+    enum : size_t
+    {
+        TextureCopyAlignment = 16,  // staging offset of buffer to texture copies
+    };
+
+    struct Stats
+    {
+        uint64_t bytesUploaded;
+        uint64_t highWaterBytes;    // staging memory in use at once (recorded or in flight)
+        uint32_t submits;           // command buffers committed
+        uint32_t stalls;            // Flush() waited for the GPU to release a buffer
+        double stallTime;           // seconds
+        uint32_t dedicatedBuffers;  // buffers created for rows longer than a staging buffer
+    };
+
+    StagingBufferRing(DKCommandQueue* q, size_t bufferLength = 1 << 20, uint32_t numBuffers = 4)
+        : queue(q)
+        , stagingBufferLength(bufferLength)
+        , current(0)
+        , bytesInFlight(0)
+        , stats()
+    {
+        DKGraphicsDevice* device = queue->Device();
+        slots.Resize(std::max(numBuffers, 2U));
+        for (Slot& slot : slots)
+        {
+            slot.buffer = device->CreateBuffer(stagingBufferLength, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
+            slot.used = 0;
+            slot.uploaded = 0;
+            slot.inFlight = false;
+        }
+    }
+
+    ~StagingBufferRing()
+    {
+        Flush();
+        WaitIdle();
+    }
+
+    // Copies 'length' bytes of 'data' to 'dst' at 'dstOffset'.
+    // Data larger than the space left in the staging buffer is split.
+    void Upload(DKGpuBuffer* dst, size_t dstOffset, const void* data, size_t length)
+    {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+        while (length > 0)
+        {
+            Slot& slot = slots.Value(current);
+            if (slot.used >= stagingBufferLength)
+            {
+                Flush();
+                continue;
+            }
+            const size_t size = std::min(length, stagingBufferLength - slot.used);
+            memcpy(reinterpret_cast<uint8_t*>(slot.buffer->Contents()) + slot.used, p, size);
+            slot.copies.Add({ slot.buffer, slot.used, dst, dstOffset, size });
+            slot.used += size;
+            slot.uploaded += size;
+
+            p += size;
+            dstOffset += size;
+            length -= size;
+        }
+    }
+
+    // Copies a tightly packed image of 'width' x 'height' pixels to mip
+    // 'level' of 'dst'. The image is split in rows over staging buffers,
+    // rows longer than a staging buffer get a buffer of their own.
+    void UploadTexture(DKTexture* dst, uint32_t level, const void* data,
+                       uint32_t width, uint32_t height, size_t bytesPerPixel)
+    {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+        const size_t rowLength = bytesPerPixel * width;
+        uint32_t y = 0;
+        while (y < height)
+        {
+            if (rowLength > stagingBufferLength)
+            {
+                const size_t length = rowLength * (height - y);
+                DKObject<DKGpuBuffer> buffer = queue->Device()->CreateBuffer(length, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
+                memcpy(buffer->Contents(), p, length);
+                buffer->Flush();
+                Slot& slot = slots.Value(current);
+                slot.copies.Add({ buffer, 0, nullptr, 0, length, dst, level, y, width, height - y });
+                slot.uploaded += length;
+                condition.Lock();
+                stats.dedicatedBuffers++;
+                condition.Unlock();
+                return;
+            }
+            Slot& slot = slots.Value(current);
+            const size_t offset = (slot.used + TextureCopyAlignment - 1) & ~size_t(TextureCopyAlignment - 1);
+            const uint32_t rows = offset < stagingBufferLength ?
+                static_cast<uint32_t>(std::min<size_t>(height - y, (stagingBufferLength - offset) / rowLength)) : 0;
+            if (rows == 0)
+            {
+                Flush();
+                continue;
+            }
+            const size_t size = rowLength * rows;
+            memcpy(reinterpret_cast<uint8_t*>(slot.buffer->Contents()) + offset, p, size);
+            slot.copies.Add({ slot.buffer, offset, nullptr, 0, size, dst, level, y, width, rows });
+            slot.used = offset + size;
+            slot.uploaded += size;
+
+            p += size;
+            y += rows;
+        }
+    }
+
+    // Device local buffer with a copy of 'data'. The buffer can be used by
+    // command buffers of the same queue committed after the next Flush().
+    DKObject<DKGpuBuffer> CreateBuffer(const void* data, size_t length)
+    {
+        DKObject<DKGpuBuffer> buffer = queue->Device()->CreateBuffer(length, DKGpuBuffer::StorageModePrivate, DKCpuCacheModeReadWrite);
+        if (buffer)
+            Upload(buffer, 0, data, length);
+        return buffer;
+    }
+
+    // 'op' is performed once the copies recorded so far are completed.
+    void AddCompletedHandler(DKOperation* op)
+    {
+        slots.Value(current).completedHandlers.Add(op);
+    }
+
+    // Records a device-side copy from 'src' to 'dst'. The copy is executed
+    // in order with the uploads before and after it.
+    void CopyBuffer(DKGpuBuffer* src, size_t srcOffset, DKGpuBuffer* dst, size_t dstOffset, size_t length)
+    {
+        if (length > 0)
+            slots.Value(current).copies.Add({ src, srcOffset, dst, dstOffset, length });
+    }
+
+    // Submits recorded copies and moves on to the next staging buffer.
+    void Flush()
+    {
+        Slot& slot = slots.Value(current);
+        if (slot.copies.IsEmpty() && slot.completedHandlers.IsEmpty())
+            return;
+
+        if (slot.used > 0)
+            slot.buffer->Flush();
+
+        DKObject<DKCommandBuffer> cb = queue->CreateCommandBuffer();
+        DKObject<DKCopyCommandEncoder> encoder = cb->CreateCopyCommandEncoder();
+        for (const Copy& c : slot.copies)
+        {
+            if (c.texture)
+                encoder->CopyFromBufferToTexture(c.src,
+                                                 { c.srcOffset, c.width, c.height },
+                                                 c.texture,
+                                                 { 0, c.level, 0, c.y, 0 },
+                                                 { c.width, c.height, 1 });
+            else
+                encoder->CopyFromBufferToBuffer(c.src, c.srcOffset, c.dst, c.dstOffset, c.length);
+        }
+        encoder->EndEncoding();
+
+        condition.Lock();
+        slot.inFlight = true;
+        bytesInFlight += slot.used;
+        stats.highWaterBytes = std::max<uint64_t>(stats.highWaterBytes, bytesInFlight);
+        stats.bytesUploaded += slot.uploaded;
+        stats.submits++;
+        condition.Unlock();
+
+        const uint32_t index = current;
+        cb->AddCompletedHandler(DKFunction([this, index]()
+        {
+            condition.Lock();
+            Slot& s = slots.Value(index);
+            s.copies.Clear();  // release referenced buffers
+            bytesInFlight -= s.used;
+            s.used = 0;
+            s.uploaded = 0;
+            DKArray<DKObject<DKOperation>> handlers = std::move(s.completedHandlers);
+            s.completedHandlers.Clear();
+            s.inFlight = false;
+            condition.Broadcast();
+            condition.Unlock();
+            for (DKOperation* op : handlers)
+                op->Perform();
+        })->Invocation());
+        cb->Commit();
+
+        current = (current + 1) % slots.Count();
+        condition.Lock();
+        if (slots.Value(current).inFlight)
+        {
+            DKTimer timer;
+            timer.Reset();
+            while (slots.Value(current).inFlight)
+                condition.Wait();
+            stats.stalls++;
+            stats.stallTime += timer.Elapsed();
+        }
+        condition.Unlock();
+    }
+
+    // Waits until all submitted copies are completed.
+    void WaitIdle()
+    {
+        for (uint32_t i = 0; i < slots.Count(); ++i)
+            WaitSlot(i);
+    }
+
+    size_t BufferLength() const { return stagingBufferLength; }
+
+    Stats GetStats() const
+    {
+        condition.Lock();
+        Stats result = stats;
+        condition.Unlock();
+        return result;
+    }
+
+    void LogStats(const char* name) const
+    {
+        const Stats s = GetStats();
+        DKLog("%s staging: %.2f MB uploaded in %u submits, high-water %.2f / %.2f MB, %u stalls (%.3fs), %u dedicated buffers",
+              name, double(s.bytesUploaded) / (1 << 20), s.submits,
+              double(s.highWaterBytes) / (1 << 20), double(stagingBufferLength * slots.Count()) / (1 << 20),
+              s.stalls, s.stallTime, s.dedicatedBuffers);
+    }
+
+private:
+    struct Copy
+    {
+        DKObject<DKGpuBuffer> src;
+        size_t srcOffset;
+        DKObject<DKGpuBuffer> dst;
+        size_t dstOffset;
+        size_t length;
+        // buffer to texture copy, if texture is not null
+        DKObject<DKTexture> texture;
+        uint32_t level;
+        uint32_t y;
+        uint32_t width;
+        uint32_t height;
+    };
+    struct Slot
+    {
+        DKObject<DKGpuBuffer> buffer;
+        size_t used;
+        size_t uploaded;    // bytes copied from the host, including dedicated buffers
+        DKArray<Copy> copies;
+        DKArray<DKObject<DKOperation>> completedHandlers;
+        bool inFlight;
+    };
+
+    void WaitSlot(uint32_t index)
+    {
+        condition.Lock();
+        while (slots.Value(index).inFlight)
+            condition.Wait();
+        condition.Unlock();
+    }
+
+    DKObject<DKCommandQueue> queue;
+    const size_t stagingBufferLength;
+    DKArray<Slot> slots;
+    uint32_t current;
+    size_t bytesInFlight;
+    Stats stats;
+    mutable DKCondition condition;
+};
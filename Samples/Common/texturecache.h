@@ -0,0 +1,296 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <DK.h>
+
+#include "meshcache.h"
+#include "mipmap.h"
+
+// Binary texture cache file, stored next to the source image as "<source>.texcache".
+//
+// Layout (all sections aligned to TextureCacheHeader::Alignment):
+//   TextureCacheHeader
+//   level data    (levelCount levels, largest first)
+//
+// Levels are stored exactly as they are uploaded (tightly packed rows), so
+// a cached texture needs neither image decoding nor mipmap generation.
+// Validated against the source file like the mesh cache (see meshcache.h).
+struct TextureCacheHeader
+{
+    enum : uint32_t
+    {
+        Magic = 0x43544b44, // 'DKTC'
+        Version = 3,
+        Alignment = 256,
+        MaxLevels = 16,
+    };
+    struct Level
+    {
+        uint64_t offset;
+        uint64_t length;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;         // TextureLoadFlags the data was built with
+    uint32_t pixelFormat;   // DKPixelFormat
+    uint32_t bytesPerPixel;
+    uint32_t levelCount;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t sourceHash;
+    Level levels[MaxLevels];
+    uint64_t fileLength;
+};
+
+enum TextureLoadFlags : uint32_t
+{
+    TextureLoadFlagMipmaps = 1, // full mip chain
+    TextureLoadFlagCache = 2,   // read and write "<source>.texcache"
+};
+
+// Pixels of all mip levels of a texture, either decoded from an image
+// or read from a mapped cache file.
+struct TextureData
+{
+    DKPixelFormat pixelFormat = DKPixelFormat::Invalid;
+    uint32_t bytesPerPixel = 0;
+    DKArray<TextureMipLevel> levels;
+    const uint8_t* pixels = nullptr;    // level offsets are relative to this
+    DKArray<uint8_t> storage;           // decoded pixels
+    DKObject<DKFileMap> file;           // mapped cache file, locked until Clear()
+
+    TextureData() = default;
+    TextureData(const TextureData&) = delete;
+    TextureData& operator = (const TextureData&) = delete;
+    ~TextureData() { Clear(); }
+
+    const uint8_t* LevelPixels(uint32_t level) const { return pixels + levels.Value(level).offset; }
+
+    void Clear()
+    {
+        if (file)
+            file->UnlockShared();
+        file = nullptr;
+        storage.Clear();
+        levels.Clear();
+        pixels = nullptr;
+    }
+};
+
+// Validates header, pixel format, mip chain and level bounds of a mapped cache file.
+inline const TextureCacheHeader* ValidateTextureCache(const void* data, size_t length,
+                                                      const char* sourcePath,
+                                                      const MeshCacheKey& key,
+                                                      uint32_t flags)
+{
+    if (data == nullptr || length < sizeof(TextureCacheHeader))
+        return nullptr;
+
+    const TextureCacheHeader* header = reinterpret_cast<const TextureCacheHeader*>(data);
+    if (header->magic != TextureCacheHeader::Magic ||
+        header->version != TextureCacheHeader::Version ||
+        header->flags != flags ||
+        header->fileLength != length ||
+        header->levelCount == 0 ||
+        header->levelCount > TextureCacheHeader::MaxLevels)
+        return nullptr;
+
+    // levels are uploaded as textures of this format and size.
+    if (static_cast<DKPixelFormat>(header->pixelFormat) != DKPixelFormat::RGBA8Unorm ||
+        header->bytesPerPixel != DKPixelFormatBytesPerPixel(DKPixelFormat::RGBA8Unorm))
+        return nullptr;
+    const uint32_t baseWidth = header->levels[0].width;
+    const uint32_t baseHeight = header->levels[0].height;
+    if (baseWidth == 0 || baseHeight == 0 ||
+        header->levelCount != ((flags & TextureLoadFlagMipmaps) ? MipLevelCount(baseWidth, baseHeight) : 1))
+        return nullptr;
+    for (uint32_t i = 0; i < header->levelCount; ++i)
+    {
+        const TextureCacheHeader::Level& level = header->levels[i];
+        if (level.width != std::max(baseWidth >> i, 1U) || level.height != std::max(baseHeight >> i, 1U))
+            return nullptr;
+        if (level.offset > length || level.length > length - level.offset ||
+            level.length != uint64_t(level.width) * level.height * header->bytesPerPixel)
+            return nullptr;
+    }
+
+    if (header->sourceSize != key.sourceSize)
+        return nullptr;
+    if (header->sourceTime != key.sourceTime)
+    {
+        // source has been touched, compare contents.
+        uint64_t hash;
+        if (!HashMeshCacheSource(sourcePath, hash) || hash != header->sourceHash)
+            return nullptr;
+    }
+    return header;
+}
+
+inline bool WriteTextureCache(const char* cachePath,
+                              const char* sourcePath,
+                              const MeshCacheKey& key,
+                              uint32_t flags,
+                              const TextureData& texture)
+{
+    auto align = [](uint64_t offset)
+    {
+        return (offset + TextureCacheHeader::Alignment - 1) & ~uint64_t(TextureCacheHeader::Alignment - 1);
+    };
+    if (texture.levels.Count() > TextureCacheHeader::MaxLevels)
+        return false;
+
+    TextureCacheHeader header = {};
+    header.magic = TextureCacheHeader::Magic;
+    header.version = TextureCacheHeader::Version;
+    header.flags = flags;
+    header.pixelFormat = static_cast<uint32_t>(texture.pixelFormat);
+    header.bytesPerPixel = texture.bytesPerPixel;
+    header.levelCount = static_cast<uint32_t>(texture.levels.Count());
+    header.sourceSize = key.sourceSize;
+    header.sourceTime = key.sourceTime;
+    if (!HashMeshCacheSource(sourcePath, header.sourceHash))
+        return false;
+    uint64_t offset = align(sizeof(TextureCacheHeader));
+    for (uint32_t i = 0; i < header.levelCount; ++i)
+    {
+        const TextureMipLevel& level = texture.levels.Value(i);
+        header.levels[i] = { offset, level.length, level.width, level.height };
+        offset = align(offset + level.length);
+    }
+    const TextureCacheHeader::Level& last = header.levels[header.levelCount - 1];
+    header.fileLength = last.offset + last.length;
+
+    std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+
+    auto writeAt = [&file](uint64_t offset, const void* p, uint64_t size)
+    {
+        static const char zero[TextureCacheHeader::Alignment] = {};
+        uint64_t pos = static_cast<uint64_t>(file.tellp());
+        if (offset > pos)
+            file.write(zero, offset - pos);
+        if (size > 0)
+            file.write(reinterpret_cast<const char*>(p), size);
+    };
+    writeAt(0, &header, sizeof(header));
+    for (uint32_t i = 0; i < header.levelCount; ++i)
+        writeAt(header.levels[i].offset, texture.LevelPixels(i), header.levels[i].length);
+    file.close();
+    if (!file)
+    {
+        remove(cachePath);
+        return false;
+    }
+    return true;
+}
+
+// Decodes an image file to RGBA8Unorm levels.
+inline bool DecodeTextureData(DKData* data, uint32_t flags, TextureData& out)
+{
+    out.Clear();
+    DKObject<DKImage> image = DKImage::Create(data);
+    if (image == nullptr)
+        return false;
+    if (image->BytesPerPixel() != DKPixelFormatBytesPerPixel(DKPixelFormat::RGBA8Unorm))
+    {
+        DKLog("Unsupported image format (%u bytes per pixel)", (uint32_t)image->BytesPerPixel());
+        return false;
+    }
+    out.pixelFormat = DKPixelFormat::RGBA8Unorm;
+    out.bytesPerPixel = static_cast<uint32_t>(image->BytesPerPixel());
+    BuildMipChainRGBA8(image->Contents(), image->Width(), image->Height(),
+                       (flags & TextureLoadFlagMipmaps) != 0, out.storage, out.levels);
+    out.pixels = out.storage;
+    return true;
+}
+
+// Loads an image file, from "<path>.texcache" if TextureLoadFlagCache is
+// set and the cache is up to date. The cache is (re)written otherwise.
+inline bool LoadTextureData(const char* path, uint32_t flags, TextureData& out)
+{
+    out.Clear();
+    const std::string cachePath = std::string(path) + ".texcache";
+    const uint32_t cacheFlags = flags & TextureLoadFlagMipmaps;
+
+    MeshCacheKey key;
+    const bool cacheable = (flags & TextureLoadFlagCache) && GetMeshCacheKey(path, key);
+    if (cacheable)
+    {
+        DKObject<DKFileMap> file = nullptr;
+        const uint8_t* data = nullptr;
+        const TextureCacheHeader* header = nullptr;
+        auto mapCache = [&]()
+        {
+            file = DKFileMap::Open(cachePath.c_str(), 0, false);
+            if (file)
+            {
+                data = reinterpret_cast<const uint8_t*>(file->LockShared());
+                header = ValidateTextureCache(data, file->Length(), path, key, cacheFlags);
+                if (header == nullptr)
+                {
+                    file->UnlockShared();
+                    file = nullptr;
+                }
+            }
+        };
+        mapCache();
+        if (header && header->sourceTime != key.sourceTime)
+        {
+            // matched by content hash, store the new time (with the file
+            // unmapped) so the next load does not hash the source again.
+            file->UnlockShared();
+            file = nullptr;
+            header = nullptr;
+            if (UpdateCacheSourceTime(cachePath.c_str(), offsetof(TextureCacheHeader, sourceTime), key))
+                mapCache();
+            else
+                DKLog("Failed to update texture cache: %s", cachePath.c_str());
+        }
+        if (header)
+        {
+            out.pixelFormat = static_cast<DKPixelFormat>(header->pixelFormat);
+            out.bytesPerPixel = header->bytesPerPixel;
+            for (uint32_t i = 0; i < header->levelCount; ++i)
+            {
+                const TextureCacheHeader::Level& level = header->levels[i];
+                out.levels.Add({ size_t(level.offset), size_t(level.length), level.width, level.height });
+            }
+            out.pixels = data;
+            out.file = file;
+            DKLog("Texture loaded from cache: %s", cachePath.c_str());
+            return true;
+        }
+    }
+
+    DKObject<DKFileMap> source = DKFileMap::Open(path, 0, false);
+    if (source == nullptr || !DecodeTextureData(source, flags, out))
+        return false;
+
+    if (cacheable && !WriteTextureCache(cachePath.c_str(), path, key, cacheFlags, out))
+        DKLog("Failed to write texture cache: %s", cachePath.c_str());
+    return true;
+}
+
+// Writes the cache of an image file ahead of time (e.g. as a build step),
+// so the first run loads it like any later run.
+inline bool PrecomputeTextureCache(const char* path, uint32_t flags = TextureLoadFlagMipmaps)
+{
+    TextureData texture;
+    DKTimer timer;
+    timer.Reset();
+    if (!LoadTextureData(path, flags | TextureLoadFlagCache, texture))
+    {
+        DKLog("Failed to load texture: %s", path);
+        return false;
+    }
+    DKLog("Texture cache: %s (%u levels, %.3fs)", path, (uint32_t)texture.levels.Count(), timer.Elapsed());
+    return true;
+}
@@ -0,0 +1,235 @@
+#pragma once
+#include <string>
+#include <DK.h>
+#include "staging.h"
+#include "texturecache.h"
+
+// Texture loaded by TextureStreamer.
+// Texture() is null until the texture is uploaded, Wait() blocks until then.
+// Both return null if the image could not be decoded or the texture could
+// not be created.
+class TextureRequest
+{
+public:
+    TextureRequest() : done(false) {}
+
+    bool IsDone() const
+    {
+        condition.Lock();
+        bool result = done;
+        condition.Unlock();
+        return result;
+    }
+    DKTexture* Texture() const
+    {
+        condition.Lock();
+        DKTexture* result = done ? (DKTexture*)texture : nullptr;
+        condition.Unlock();
+        return result;
+    }
+    DKTexture* Wait() const
+    {
+        condition.Lock();
+        while (!done)
+            condition.Wait();
+        condition.Unlock();
+        return texture;
+    }
+
+private:
+    friend class TextureStreamer;
+    void Complete(DKTexture* tex)
+    {
+        condition.Lock();
+        texture = tex;
+        done = true;
+        condition.Broadcast();
+        condition.Unlock();
+    }
+
+    DKObject<DKData> data;
+    std::string path;
+    uint32_t usage;
+    uint32_t flags;
+    TextureData textureData;
+    DKObject<DKTexture> texture;
+    bool done;
+    mutable DKCondition condition;
+};
+
+// Loads 2D textures in the background.
+// Worker threads decode images (or read them from the texture cache) and
+// build mipmaps, an upload thread copies all levels through a
+// StagingBufferRing, so textures decoded by the time of a submit share one
+// command buffer. LoadTexture2D() returns immediately, callers wait on the
+// request only where they need the texture.
+class TextureStreamer
+{
+public:
+    TextureStreamer(DKCommandQueue* q, uint32_t numWorkers = 2,
+                    size_t stagingBufferLength = 1 << 22, uint32_t numStagingBuffers = 3)
+        : queue(q)
+        , staging(q, stagingBufferLength, numStagingBuffers)
+        , running(true)
+    {
+        for (uint32_t i = 0; i < std::max(numWorkers, 1U); ++i)
+            workers.Add(DKThread::Create(DKFunction(this, &TextureStreamer::DecodeThread)->Invocation()));
+        uploader = DKThread::Create(DKFunction(this, &TextureStreamer::UploadThread)->Invocation());
+    }
+
+    ~TextureStreamer()
+    {
+        condition.Lock();
+        running = false;
+        condition.Broadcast();
+        condition.Unlock();
+
+        for (DKThread* thread : workers)
+            thread->WaitTerminate();
+        uploader->WaitTerminate();
+
+        // requests not started yet
+        for (TextureRequest* request : pending)
+            request->Complete(nullptr);
+        for (TextureRequest* request : decoded)
+            request->Complete(nullptr);
+    }
+
+    // Image file data to a RGBA8Unorm texture, see TextureLoadFlags.
+    // Storage images need a single level, use 0 for 'flags' then.
+    DKObject<TextureRequest> LoadTexture2D(DKData* data,
+                                           uint32_t usage = DKTexture::UsageCopyDestination | DKTexture::UsageSampled,
+                                           uint32_t flags = TextureLoadFlagMipmaps)
+    {
+        DKObject<TextureRequest> request = DKOBJECT_NEW TextureRequest();
+        request->data = data;
+        if (data == nullptr)
+        {
+            request->Complete(nullptr);
+            return request;
+        }
+        return Enqueue(request, usage, flags & ~uint32_t(TextureLoadFlagCache));
+    }
+
+    // Image file at 'path', cached as "<path>.texcache" by default.
+    DKObject<TextureRequest> LoadTexture2D(const char* path,
+                                           uint32_t usage = DKTexture::UsageCopyDestination | DKTexture::UsageSampled,
+                                           uint32_t flags = TextureLoadFlagMipmaps | TextureLoadFlagCache)
+    {
+        DKObject<TextureRequest> request = DKOBJECT_NEW TextureRequest();
+        request->path = path;
+        return Enqueue(request, usage, flags);
+    }
+
+private:
+    DKObject<TextureRequest> Enqueue(TextureRequest* request, uint32_t usage, uint32_t flags)
+    {
+        request->usage = usage | DKTexture::UsageCopyDestination;
+        request->flags = flags;
+        condition.Lock();
+        pending.Add(request);
+        condition.Broadcast();
+        condition.Unlock();
+        return request;
+    }
+
+    void DecodeThread()
+    {
+        condition.Lock();
+        while (running)
+        {
+            if (pending.IsEmpty())
+            {
+                condition.Wait();
+                continue;
+            }
+            DKObject<TextureRequest> request = pending.Value(0);
+            pending.Remove(0);
+            condition.Unlock();
+
+            bool loaded;
+            if (request->data)
+                loaded = DecodeTextureData(request->data, request->flags, request->textureData);
+            else
+                loaded = LoadTextureData(request->path.c_str(), request->flags, request->textureData);
+            request->data = nullptr;
+
+            condition.Lock();
+            if (loaded)
+            {
+                decoded.Add(request);
+                condition.Broadcast();
+            }
+            else
+                request->Complete(nullptr);
+        }
+        condition.Unlock();
+    }
+
+    void UploadThread()
+    {
+        DKArray<DKObject<TextureRequest>> batch;
+        condition.Lock();
+        while (running)
+        {
+            if (decoded.IsEmpty())
+            {
+                condition.Wait();
+                continue;
+            }
+            batch = std::move(decoded);
+            decoded.Clear();
+            condition.Unlock();
+
+            for (TextureRequest* request : batch)
+            {
+                TextureData& data = request->textureData;
+                DKTextureDescriptor texDesc = {};
+                texDesc.textureType = DKTexture::Type2D;
+                texDesc.pixelFormat = data.pixelFormat;
+                texDesc.width = data.levels.Value(0).width;
+                texDesc.height = data.levels.Value(0).height;
+                texDesc.depth = 1;
+                texDesc.mipmapLevels = static_cast<uint32_t>(data.levels.Count());
+                texDesc.sampleCount = 1;
+                texDesc.arrayLength = 1;
+                texDesc.usage = request->usage;
+                DKObject<DKTexture> tex = queue->Device()->CreateTexture(texDesc);
+                if (tex)
+                {
+                    for (uint32_t level = 0; level < data.levels.Count(); ++level)
+                    {
+                        const TextureMipLevel& mip = data.levels.Value(level);
+                        staging.UploadTexture(tex, level, data.LevelPixels(level), mip.width, mip.height, data.bytesPerPixel);
+                    }
+                    // command buffers of the queue complete in order, this
+                    // handler runs after all staging buffers of the texture.
+                    DKObject<TextureRequest> r = request;
+                    staging.AddCompletedHandler(DKFunction([r, tex]()
+                    {
+                        r->Complete(tex);
+                    })->Invocation());
+                }
+                else
+                    request->Complete(nullptr);
+                data.Clear();
+            }
+            staging.Flush();
+            batch.Clear();
+
+            condition.Lock();
+        }
+        condition.Unlock();
+        staging.WaitIdle();
+    }
+
+    DKObject<DKCommandQueue> queue;
+    StagingBufferRing staging;
+    DKArray<DKObject<DKThread>> workers;
+    DKObject<DKThread> uploader;
+
+    DKArray<DKObject<TextureRequest>> pending;  // to decode
+    DKArray<DKObject<TextureRequest>> decoded;  // to upload
+    bool running;
+    DKCondition condition;
+};
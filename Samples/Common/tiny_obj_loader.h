@@ -341,6 +341,51 @@ void LoadMtl(std::map<std::string, int> *material_map,
              std::vector<material_t> *materials, std::istream *inStream,
              std::string *warning);
 
+/// Parses a floating point number in [s, s_end) the same way as values of
+/// .obj/.mtl statements are parsed. Numbers whose digits fit a significand
+/// of at most 2^53 with a decimal exponent within [-22, 22] (virtually every
+/// number written by exporters) are converted with one multiplication or
+/// division, others with strtod(); both are correctly rounded. When `fast` is
+/// false, the generic digit-by-digit conversion is used instead, which is
+/// only approximate. Exposed for testing and benchmarking.
+bool ParseDouble(const char *s, const char *s_end, double *result,
+                 bool fast = true);
+
+/// Intermediate result of parsing a range of whole lines of an .obj file.
+/// Ranges can be parsed concurrently with ParseObjChunk() and then be
+/// combined in file order with LoadObjFromChunks(), which gives the same
+/// result as LoadObj() on the whole file.
+typedef struct {
+  std::vector<real_t> vertices;   // 'v'
+  std::vector<real_t> normals;    // 'vn'
+  std::vector<real_t> texcoords;  // 'vt'
+
+  // Face corners with zero-based indices. Relative (negative) indices are
+  // resolved against the counts of this chunk only, and marked in
+  // `relative_flags` (1: vertex, 2: normal, 4: texcoord) so that the number
+  // of elements in the preceding chunks can be added when combining.
+  std::vector<index_t> face_indices;
+  std::vector<unsigned char> relative_flags;
+  std::vector<int> face_num_vertices;
+
+  // 'usemtl', 'mtllib', 'g', 'o' and 't' lines, with the number of faces of
+  // this chunk that precede each of them.
+  std::vector<std::string> statements;
+  std::vector<size_t> statement_faces;
+} obj_chunk_t;
+
+/// Parses lines in [buf, buf + len) into `chunk`.
+/// `buf` does not need to be null-terminated. Safe to call concurrently.
+void ParseObjChunk(obj_chunk_t *chunk, const char *buf, size_t len);
+
+/// Combines chunks that were parsed from consecutive ranges of one .obj file.
+/// Returns warning and error message into `err`
+bool LoadObjFromChunks(attrib_t *attrib, std::vector<shape_t> *shapes,
+                       std::vector<material_t> *materials, std::string *err,
+                       const std::vector<obj_chunk_t> &chunks,
+                       MaterialReader *readMatFn = NULL,
+                       bool triangulate = true);
+
 }  // namespace tinyobj
 
 #endif  // TINY_OBJ_LOADER_H_
@@ -348,10 +393,12 @@ void LoadMtl(std::map<std::string, int> *material_map,
 #ifdef TINYOBJLOADER_IMPLEMENTATION
 #include <cassert>
 #include <cctype>
+#include <clocale>
 #include <cmath>
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <stdint.h>
 #include <utility>
 
 #include <fstream>
@@ -471,7 +518,8 @@ static inline int parseInt(const char **token) {
 //  - s >= s_end.
 //  - parse failure.
 //
-static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+static bool tryParseDoubleGeneric(const char *s, const char *s_end,
+                                  double *result) {
   if (s >= s_end) {
     return false;
   }
@@ -586,9 +634,134 @@ fail:
   return false;
 }
 
+// Correctly rounded conversion of [s, s_end), already validated by
+// tryParseDouble(), with strtod(). The copy is NUL terminated and uses the
+// decimal point of the current C locale, so the result does not depend on it.
+static bool parseDoubleStrtod(const char *s, const char *s_end,
+                              double *result) {
+  char buffer[64];
+  std::string long_token;
+  const size_t length = static_cast<size_t>(s_end - s);
+  char *text = buffer;
+  if (length >= sizeof(buffer)) {
+    long_token.assign(s, length);
+    text = &long_token[0];
+  } else {
+    memcpy(buffer, s, length);
+    buffer[length] = '\0';
+  }
+  const char decimal_point = localeconv()->decimal_point[0];
+  if (decimal_point != '.') {
+    char *dot = strchr(text, '.');
+    if (dot) *dot = decimal_point;
+  }
+  char *end = NULL;
+  const double value = strtod(text, &end);
+  if (end == text) return false;
+  *result = value;
+  return true;
+}
+
+// Fast conversion for the common case (Clinger's fast path):
+// if the decimal significand and 10^|exponent| are both exactly representable
+// as double, one IEEE multiplication or division gives the correctly rounded
+// result. Everything else (a significand above 2^53, more than 19 digits or
+// a large exponent) is handed to parseDoubleStrtod().
+static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+  static const double exact_pow10[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+
+  if (s >= s_end) {
+    return false;
+  }
+
+  // Sign without a branch, numbers of both signs are equally common.
+  const char *curr = s;
+  const bool negative = (*curr == '-');
+  curr += (negative | (*curr == '+'));
+
+  // Accumulate integer and decimal digits into one integer significand.
+  uint64_t mantissa = 0;
+  const char *int_begin = curr;
+  while (curr < s_end && IS_DIGIT(*curr)) {
+    mantissa = mantissa * 10 + static_cast<uint64_t>(*curr - '0');
+    curr++;
+  }
+  // We must make sure we actually got something.
+  if (curr == int_begin) return false;
+  int num_digits = static_cast<int>(curr - int_begin);
+
+  int exponent = 0;
+  if (curr < s_end && *curr == '.') {
+    curr++;
+    const char *frac_begin = curr;
+    while (curr < s_end && IS_DIGIT(*curr)) {
+      mantissa = mantissa * 10 + static_cast<uint64_t>(*curr - '0');
+      curr++;
+    }
+    exponent = -static_cast<int>(curr - frac_begin);
+    num_digits -= exponent;
+  }
+
+  if (curr < s_end && (*curr == 'e' || *curr == 'E')) {
+    curr++;
+    bool exp_negative = false;
+    if (curr < s_end && (*curr == '+' || *curr == '-')) {
+      exp_negative = (*curr == '-');
+      curr++;
+    }
+    if (curr >= s_end || !IS_DIGIT(*curr)) {
+      // Empty E is not allowed.
+      return false;
+    }
+    int e = 0;
+    while (curr < s_end && IS_DIGIT(*curr)) {
+      if (e < 100000) e = e * 10 + (*curr - '0');
+      curr++;
+    }
+    exponent += exp_negative ? -e : e;
+  }
+
+  // The significand may have wrapped around if there were more than 19
+  // digits (leading zeros included).
+  if (num_digits <= 19 && mantissa <= (uint64_t(1) << 53) &&
+      exponent >= -22 && exponent <= 22) {
+    double value = static_cast<double>(mantissa);
+    if (exponent < 0)
+      value /= exact_pow10[-exponent];
+    else
+      value *= exact_pow10[exponent];
+    *result = negative ? -value : value;
+    return true;
+  }
+  return parseDoubleStrtod(s, curr, result);
+}
+
+bool ParseDouble(const char *s, const char *s_end, double *result,
+                 bool fast) {
+  if (fast) return tryParseDouble(s, s_end, result);
+  return tryParseDoubleGeneric(s, s_end, result);
+}
+
+// Same as strspn(token, " \t") and strcspn(token, " \t\r"), but without
+// building a character set on every call.
+static inline const char *skipSpaceAndTab(const char *token) {
+  while ((*token) == ' ' || (*token) == '\t') token++;
+  return token;
+}
+
+static inline const char *findRealEnd(const char *token) {
+  while ((*token) != ' ' && (*token) != '\t' && (*token) != '\r' &&
+         (*token) != '\0')
+    token++;
+  return token;
+}
+
 static inline real_t parseReal(const char **token, double default_value = 0.0) {
-  (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
+  (*token) = skipSpaceAndTab(*token);
+  const char *end = findRealEnd(*token);
   double val = default_value;
   tryParseDouble((*token), end, &val);
   real_t f = static_cast<real_t>(val);
@@ -1729,6 +1902,467 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
   return true;
 }
 
+// Same as fixIndex(), but relative indices are resolved against the counts
+// of the current chunk and reported through `flags`.
+static inline int fixChunkIndex(int idx, int n, unsigned char bit,
+                                unsigned char *flags) {
+  if (idx < 0) (*flags) |= bit;
+  return fixIndex(idx, n);
+}
+
+// Same as parseTriple(), see fixChunkIndex().
+static vertex_index parseChunkTriple(const char **token, int vsize,
+                                     int vnsize, int vtsize,
+                                     unsigned char *flags) {
+  vertex_index vi(-1);
+  (*flags) = 0;
+
+  vi.v_idx = fixChunkIndex(atoi((*token)), vsize, 1, flags);
+  (*token) += strcspn((*token), "/ \t\r");
+  if ((*token)[0] != '/') {
+    return vi;
+  }
+  (*token)++;
+
+  // i//k
+  if ((*token)[0] == '/') {
+    (*token)++;
+    vi.vn_idx = fixChunkIndex(atoi((*token)), vnsize, 2, flags);
+    (*token) += strcspn((*token), "/ \t\r");
+    return vi;
+  }
+
+  // i/j/k or i/j
+  vi.vt_idx = fixChunkIndex(atoi((*token)), vtsize, 4, flags);
+  (*token) += strcspn((*token), "/ \t\r");
+  if ((*token)[0] != '/') {
+    return vi;
+  }
+
+  // i/j/k
+  (*token)++;  // skip '/'
+  vi.vn_idx = fixChunkIndex(atoi((*token)), vnsize, 2, flags);
+  (*token) += strcspn((*token), "/ \t\r");
+  return vi;
+}
+
+void ParseObjChunk(obj_chunk_t *chunk, const char *buf, size_t len) {
+  const char *p = buf;
+  const char *end = buf + len;
+
+  std::string linebuf;
+  while (p < end) {
+    // Same line endings as safeGetline(): '\n', '\r' or "\r\n".
+    const char *eol = p;
+    while (eol < end && *eol != '\n' && *eol != '\r') eol++;
+    linebuf.assign(p, eol);
+    p = eol;
+    if (p < end) {
+      if (*p == '\r' && p + 1 < end && p[1] == '\n')
+        p += 2;
+      else
+        p++;
+    }
+
+    if (linebuf.empty()) continue;
+
+    // Skip leading space.
+    const char *token = linebuf.c_str();
+    token += strspn(token, " \t");
+
+    if (token[0] == '\0') continue;  // empty line
+
+    if (token[0] == '#') continue;  // comment line
+
+    // vertex
+    if (token[0] == 'v' && IS_SPACE((token[1]))) {
+      token += 2;
+      real_t x, y, z;
+      parseReal3(&x, &y, &z, &token);
+      chunk->vertices.push_back(x);
+      chunk->vertices.push_back(y);
+      chunk->vertices.push_back(z);
+      continue;
+    }
+
+    // normal
+    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+      token += 3;
+      real_t x, y, z;
+      parseReal3(&x, &y, &z, &token);
+      chunk->normals.push_back(x);
+      chunk->normals.push_back(y);
+      chunk->normals.push_back(z);
+      continue;
+    }
+
+    // texcoord
+    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+      token += 3;
+      real_t x, y;
+      parseReal2(&x, &y, &token);
+      chunk->texcoords.push_back(x);
+      chunk->texcoords.push_back(y);
+      continue;
+    }
+
+    // face
+    if (token[0] == 'f' && IS_SPACE((token[1]))) {
+      token += 2;
+      token += strspn(token, " \t");
+
+      int num_vertices = 0;
+      while (!IS_NEW_LINE(token[0])) {
+        unsigned char flags;
+        vertex_index vi = parseChunkTriple(
+            &token, static_cast<int>(chunk->vertices.size() / 3),
+            static_cast<int>(chunk->normals.size() / 3),
+            static_cast<int>(chunk->texcoords.size() / 2), &flags);
+
+        index_t idx;
+        idx.vertex_index = vi.v_idx;
+        idx.normal_index = vi.vn_idx;
+        idx.texcoord_index = vi.vt_idx;
+        chunk->face_indices.push_back(idx);
+        chunk->relative_flags.push_back(flags);
+        num_vertices++;
+
+        size_t n = strspn(token, " \t\r");
+        token += n;
+      }
+      chunk->face_num_vertices.push_back(num_vertices);
+      continue;
+    }
+
+    if (((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) ||
+        ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) ||
+        (token[0] == 'g' && IS_SPACE((token[1]))) ||
+        (token[0] == 'o' && IS_SPACE((token[1]))) ||
+        (token[0] == 't' && IS_SPACE((token[1])))) {
+      chunk->statements.push_back(std::string(token));
+      chunk->statement_faces.push_back(chunk->face_num_vertices.size());
+      continue;
+    }
+
+    // Ignore unknown command.
+  }
+}
+
+// exportFaceGroupToShape() for the faces [face_begin, face_end) of flattened
+// face arrays. `corner` is the offset of the first corner of `face_begin`,
+// and is advanced past the exported faces.
+static bool exportFaceRangeToShape(shape_t *shape,
+                                   const std::vector<index_t> &indices,
+                                   const std::vector<int> &num_vertices,
+                                   size_t face_begin, size_t face_end,
+                                   size_t *corner,
+                                   const std::vector<tag_t> &tags,
+                                   const int material_id,
+                                   const std::string &name, bool triangulate) {
+  if (face_begin >= face_end) {
+    return false;
+  }
+
+  for (size_t i = face_begin; i < face_end; i++) {
+    const index_t *face = &indices[*corner];
+    size_t npolys = static_cast<size_t>(num_vertices[i]);
+    (*corner) += npolys;
+
+    if (triangulate) {
+      // Polygon -> triangle fan conversion
+      for (size_t k = 2; k < npolys; k++) {
+        shape->mesh.indices.push_back(face[0]);
+        shape->mesh.indices.push_back(face[k - 1]);
+        shape->mesh.indices.push_back(face[k]);
+
+        shape->mesh.num_face_vertices.push_back(3);
+        shape->mesh.material_ids.push_back(material_id);
+      }
+    } else {
+      for (size_t k = 0; k < npolys; k++) {
+        shape->mesh.indices.push_back(face[k]);
+      }
+
+      shape->mesh.num_face_vertices.push_back(
+          static_cast<unsigned char>(npolys));
+      shape->mesh.material_ids.push_back(material_id);  // per face
+    }
+  }
+
+  shape->name = name;
+  shape->mesh.tags = tags;
+
+  return true;
+}
+
+bool LoadObjFromChunks(attrib_t *attrib, std::vector<shape_t> *shapes,
+                       std::vector<material_t> *materials, std::string *err,
+                       const std::vector<obj_chunk_t> &chunks,
+                       MaterialReader *readMatFn /*= NULL*/,
+                       bool triangulate) {
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  shapes->clear();
+
+  size_t num_v = 0, num_vn = 0, num_vt = 0, num_corners = 0, num_faces = 0;
+  for (size_t c = 0; c < chunks.size(); c++) {
+    num_v += chunks[c].vertices.size();
+    num_vn += chunks[c].normals.size();
+    num_vt += chunks[c].texcoords.size();
+    num_corners += chunks[c].face_indices.size();
+    num_faces += chunks[c].face_num_vertices.size();
+  }
+  attrib->vertices.reserve(num_v);
+  attrib->normals.reserve(num_vn);
+  attrib->texcoords.reserve(num_vt);
+
+  // Concatenate chunks, and rebase relative indices.
+  std::vector<index_t> indices;
+  std::vector<int> num_vertices;
+  indices.reserve(num_corners);
+  num_vertices.reserve(num_faces);
+
+  std::vector<const std::string *> statements;
+  std::vector<size_t> statement_faces;
+
+  for (size_t c = 0; c < chunks.size(); c++) {
+    const obj_chunk_t &chunk = chunks[c];
+    const int v_base = static_cast<int>(attrib->vertices.size() / 3);
+    const int vn_base = static_cast<int>(attrib->normals.size() / 3);
+    const int vt_base = static_cast<int>(attrib->texcoords.size() / 2);
+    const size_t face_base = num_vertices.size();
+
+    attrib->vertices.insert(attrib->vertices.end(), chunk.vertices.begin(),
+                            chunk.vertices.end());
+    attrib->normals.insert(attrib->normals.end(), chunk.normals.begin(),
+                           chunk.normals.end());
+    attrib->texcoords.insert(attrib->texcoords.end(), chunk.texcoords.begin(),
+                             chunk.texcoords.end());
+
+    for (size_t i = 0; i < chunk.face_indices.size(); i++) {
+      index_t idx = chunk.face_indices[i];
+      const unsigned char flags = chunk.relative_flags[i];
+      if (flags & 1) idx.vertex_index += v_base;
+      if (flags & 2) idx.normal_index += vn_base;
+      if (flags & 4) idx.texcoord_index += vt_base;
+      indices.push_back(idx);
+    }
+    num_vertices.insert(num_vertices.end(), chunk.face_num_vertices.begin(),
+                        chunk.face_num_vertices.end());
+
+    for (size_t i = 0; i < chunk.statements.size(); i++) {
+      statements.push_back(&chunk.statements[i]);
+      statement_faces.push_back(face_base + chunk.statement_faces[i]);
+    }
+  }
+
+  // Replay statements in file order, same as LoadObj().
+  std::vector<tag_t> tags;
+  std::string name;
+
+  // material
+  std::map<std::string, int> material_map;
+  int material = -1;
+
+  shape_t shape;
+
+  size_t group_begin = 0;  // first face of the current face group
+  size_t corner = 0;       // first corner of `group_begin`
+
+  for (size_t s = 0; s < statements.size(); s++) {
+    const size_t group_end = statement_faces[s];
+    const char *token = statements[s]->c_str();
+
+    // use mtl
+    if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
+      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+      token += 7;
+#ifdef _MSC_VER
+      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+      std::sscanf(token, "%s", namebuf);
+#endif
+
+      int newMaterialId = -1;
+      if (material_map.find(namebuf) != material_map.end()) {
+        newMaterialId = material_map[namebuf];
+      } else {
+        // { error!! material not found }
+      }
+
+      if (newMaterialId != material) {
+        exportFaceRangeToShape(&shape, indices, num_vertices, group_begin,
+                               group_end, &corner, tags, material, name,
+                               triangulate);
+        group_begin = group_end;
+        material = newMaterialId;
+      }
+
+      continue;
+    }
+
+    // load mtl
+    if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+      if (readMatFn) {
+        token += 7;
+
+        std::vector<std::string> filenames;
+        SplitString(std::string(token), ' ', filenames);
+
+        if (filenames.empty()) {
+          if (err) {
+            (*err) +=
+                "WARN: Looks like empty filename for mtllib. Use default "
+                "material. \n";
+          }
+        } else {
+          bool found = false;
+          for (size_t f = 0; f < filenames.size(); f++) {
+            std::string err_mtl;
+            bool ok = (*readMatFn)(filenames[f].c_str(), materials,
+                                   &material_map, &err_mtl);
+            if (err && (!err_mtl.empty())) {
+              (*err) += err_mtl;  // This should be warn message.
+            }
+
+            if (ok) {
+              found = true;
+              break;
+            }
+          }
+
+          if (!found) {
+            if (err) {
+              (*err) +=
+                  "WARN: Failed to load material file(s). Use default "
+                  "material.\n";
+            }
+          }
+        }
+      }
+
+      continue;
+    }
+
+    // group name
+    if (token[0] == 'g' && IS_SPACE((token[1]))) {
+      // flush previous face group.
+      bool ret = exportFaceRangeToShape(&shape, indices, num_vertices,
+                                        group_begin, group_end, &corner, tags,
+                                        material, name, triangulate);
+      if (ret) {
+        shapes->push_back(shape);
+      }
+
+      shape = shape_t();
+
+      group_begin = group_end;
+
+      std::vector<std::string> names;
+      names.reserve(2);
+
+      while (!IS_NEW_LINE(token[0])) {
+        std::string str = parseString(&token);
+        names.push_back(str);
+        token += strspn(token, " \t\r");  // skip tag
+      }
+
+      assert(names.size() > 0);
+
+      // names[0] must be 'g', so skip the 0th element.
+      if (names.size() > 1) {
+        name = names[1];
+      } else {
+        name = "";
+      }
+
+      continue;
+    }
+
+    // object name
+    if (token[0] == 'o' && IS_SPACE((token[1]))) {
+      // flush previous face group.
+      bool ret = exportFaceRangeToShape(&shape, indices, num_vertices,
+                                        group_begin, group_end, &corner, tags,
+                                        material, name, triangulate);
+      if (ret) {
+        shapes->push_back(shape);
+      }
+
+      group_begin = group_end;
+      shape = shape_t();
+
+      // @todo { multiple object name? }
+      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+      token += 2;
+#ifdef _MSC_VER
+      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+      std::sscanf(token, "%s", namebuf);
+#endif
+      name = std::string(namebuf);
+
+      continue;
+    }
+
+    if (token[0] == 't' && IS_SPACE(token[1])) {
+      tag_t tag;
+
+      char namebuf[4096];
+      token += 2;
+#ifdef _MSC_VER
+      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+      std::sscanf(token, "%s", namebuf);
+#endif
+      tag.name = std::string(namebuf);
+
+      token += tag.name.size() + 1;
+
+      tag_sizes ts = parseTagTriple(&token);
+
+      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+
+      for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+        tag.intValues[i] = atoi(token);
+        token += strcspn(token, "/ \t\r") + 1;
+      }
+
+      tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
+      for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
+        tag.floatValues[i] = parseReal(&token);
+        token += strcspn(token, "/ \t\r") + 1;
+      }
+
+      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+      for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+        char stringValueBuffer[4096];
+
+#ifdef _MSC_VER
+        sscanf_s(token, "%s", stringValueBuffer,
+                 (unsigned)_countof(stringValueBuffer));
+#else
+        std::sscanf(token, "%s", stringValueBuffer);
+#endif
+        tag.stringValues[i] = stringValueBuffer;
+        token += tag.stringValues[i].size() + 1;
+      }
+
+      tags.push_back(tag);
+    }
+  }
+
+  bool ret = exportFaceRangeToShape(&shape, indices, num_vertices, group_begin,
+                                    num_vertices.size(), &corner, tags,
+                                    material, name, triangulate);
+  if (ret || shape.mesh.indices.size()) {
+    shapes->push_back(shape);
+  }
+
+  return true;
+}
+
 bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
                          void *user_data /*= NULL*/,
                          MaterialReader *readMatFn /*= NULL*/,
@@ -2,6 +2,8 @@
 #include "Win32/stdafx.h"
 #endif
 #include <DK.h>
+#include "indexbuffer.h"
+#include "staging.h"
 
 DKString ShaderStageNames(uint32_t s)
 {
@@ -289,10 +291,12 @@ class GPUGeometry
 protected:
     DKObject<DKGpuBuffer> indexBuffer;
     DKObject<DKGpuBuffer> vertexBuffer;
+    DKIndexType indexType = DKIndexType::UInt32;
     DKVertexDescriptor vertexDesc;
 public:
-    virtual void InitializeGpuResource(DKCommandQueue* queue) = 0;
+    virtual void InitializeGpuResource(StagingBufferRing& staging) = 0;
     virtual DKGpuBuffer* VertexBuffer()  final  { return vertexBuffer; }
     virtual DKGpuBuffer* IndexBuffer()  final { return indexBuffer; }
+    virtual DKIndexType IndexType() const final { return indexType; }
     virtual const DKVertexDescriptor& VertexDescriptor() const final { return vertexDesc; }
 };
\ No newline at end of file
@@ -1,6 +1,10 @@
 #include <cstddef>
 #include "app.h"
 #include "util.h"
+#include "commandpool.h"
+#include "pipelinecache.h"
+#include "rendertargetpool.h"
+#include "texturestream.h"
 
 class UVQuad : public GPUGeometry
 {
@@ -29,19 +33,17 @@ public:
     UVQuad::Vertex* VerticesData() { return vertices; }
     uint32_t* IndicesData() { return indices; }
 
-    void InitializeGpuResource(DKCommandQueue* queue)
+    void InitializeGpuResource(StagingBufferRing& staging) override
     {
-        DKGraphicsDevice* device = queue->Device();
-        uint32_t vertexBufferSize = static_cast<uint32_t>(VerticesCount()) * sizeof(UVQuad::Vertex);
-        uint32_t indexBufferSize = IndicesCount() * sizeof(uint32_t);
+        IndexBufferData indexData;
+        BuildIndexBufferData(IndicesData(), IndicesCount(), VerticesCount(), nullptr, 0, indexData);
+        indexType = indexData.indexType;
 
-        vertexBuffer = device->CreateBuffer(vertexBufferSize, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-        memcpy(vertexBuffer->Contents(), VerticesData(), vertexBufferSize);
-        vertexBuffer->Flush();
+        uint32_t vertexBufferSize = static_cast<uint32_t>(VerticesCount()) * sizeof(UVQuad::Vertex);
+        uint32_t indexBufferSize = static_cast<uint32_t>(indexData.data.Count());
 
-        indexBuffer = device->CreateBuffer(indexBufferSize, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-        memcpy(indexBuffer->Contents(), IndicesData(), indexBufferSize);
-        indexBuffer->Flush();
+        vertexBuffer = staging.CreateBuffer(VerticesData(), vertexBufferSize);
+        indexBuffer = staging.CreateBuffer(indexData.data, indexBufferSize);
 
         // setup vertex buffer and attributes
         vertexDesc.attributes = {
@@ -57,30 +59,27 @@ public:
 class GPUShader
 {
 private:
-    DKObject<DKData> shaderData = nullptr;
-    DKObject<DKShaderModule> shaderModule = nullptr;
+    CachedShader shader;
     DKObject<DKShaderFunction> shaderFunc = nullptr;
 public:
 
     struct { uint32_t x, y, z; } threadgroupSize;
 
-    GPUShader(DKData* data) : shaderData(data), threadgroupSize{1,1,1}
+    GPUShader(DKResourcePool& pool, const char* name) : shader(pool, name), threadgroupSize{1,1,1}
     {
     }
 
-    void InitializeGpuResource(DKCommandQueue* queue)
+    void InitializeGpuResource(PipelineCache& pipelineCache)
     {
-        if (shaderData)
+        if (shader.Data())
         {
-            DKGraphicsDevice* device = queue->Device();
-            DKShader shader(shaderData);
-            shaderModule = device->CreateShaderModule(&shader);
-            shaderFunc = shaderModule->CreateFunction(shaderModule->FunctionNames().Value(0));
-            if (shaderFunc)
+            shaderFunc = pipelineCache.CreateShaderFunction(shader);
+            const DKShader* reflection = shaderFunc ? shader.Shader() : nullptr;
+            if (reflection)
             {
-                threadgroupSize = { shader.ThreadgroupSize().x,
-                                    shader.ThreadgroupSize().y,
-                                    shader.ThreadgroupSize().z };
+                threadgroupSize = { reflection->ThreadgroupSize().x,
+                                    reflection->ThreadgroupSize().y,
+                                    reflection->ThreadgroupSize().z };
             }
         }
     }
@@ -176,56 +175,6 @@ class ComputeShaderDemo : public SampleApp
     DKObject<GraphicShaderBindingSet> graphicShaderBindingSet = nullptr;
 
 public:
-	DKObject<DKTexture> LoadTexture2D(DKCommandQueue* queue, DKData* data)
-    {
-        DKObject<DKImage> image = DKImage::Create(data);
-        if (image)
-        {
-            DKGraphicsDevice* device = queue->Device();
-            DKTextureDescriptor texDesc = {};
-            texDesc.textureType = DKTexture::Type2D;
-            texDesc.pixelFormat = DKPixelFormat::RGBA8Unorm;
-            texDesc.width = image->Width();
-            texDesc.height = image->Height();
-            texDesc.depth = 1;
-            texDesc.mipmapLevels = 1;
-            texDesc.sampleCount = 1;
-            texDesc.arrayLength = 1;
-            texDesc.usage = DKTexture::UsageStorage | DKTexture::UsageShaderRead | DKTexture::UsageCopyDestination | DKTexture::UsageSampled;
-            DKObject<DKTexture> tex = device->CreateTexture(texDesc);
-            if (tex)
-            {
-                size_t bytesPerPixel = image->BytesPerPixel();
-                DKASSERT_DESC(bytesPerPixel == DKPixelFormatBytesPerPixel(texDesc.pixelFormat), "BytesPerPixel mismatch!");
-
-                uint32_t width = image->Width();
-                uint32_t height = image->Height();
-
-                size_t bufferLength = bytesPerPixel * width * height;
-                DKObject<DKGpuBuffer> stagingBuffer = device->CreateBuffer(bufferLength, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-
-                memcpy(stagingBuffer->Contents(), image->Contents(), bufferLength);
-                stagingBuffer->Flush();
-
-                DKObject<DKCommandBuffer> cb = queue->CreateCommandBuffer();
-                DKObject<DKCopyCommandEncoder> encoder = cb->CreateCopyCommandEncoder();
-                encoder->CopyFromBufferToTexture(stagingBuffer,
-                                                 { 0, width, height },
-                                                 tex,
-                                                 { 0,0, 0,0,0 },
-                                                 { width,height,1 });
-                encoder->EndEncoding();
-                cb->Commit();
-
-                DKLog("Texture created!");
-                return tex;
-            }
-        }
-        return nullptr;
-    }
-
-
-
     void RenderThread(void)
     {
         // Device and Queue Preperation
@@ -248,30 +197,36 @@ public:
             computeQueue = device->CreateCommandQueue(DKCommandQueue::Compute);
         }
 
+        // decoded and uploaded while geometry and shaders are being created.
+        TextureStreamer textureStreamer(graphicsQueue);
+        DKObject<TextureRequest> textureRequest = textureStreamer.LoadTexture2D(resourcePool.LoadResourceData("textures/Vulkan.png"),
+            DKTexture::UsageStorage | DKTexture::UsageShaderRead | DKTexture::UsageCopyDestination | DKTexture::UsageSampled,
+            0); // storage image, single level
+
+        // buffers are uploaded through a ring of staging buffers kept for the queue.
+        StagingBufferRing staging(graphicsQueue);
+
         // Geometry Initialzie
-        quad->InitializeGpuResource(graphicsQueue);
+        quad->InitializeGpuResource(staging);
+        staging.Flush();
 
         // create shaders
-		DKObject<DKData> vertData = resourcePool.LoadResourceData("shaders/ComputeShader/texture.vert.spv");
-		DKObject<DKData> fragData = resourcePool.LoadResourceData("shaders/ComputeShader/texture.frag.spv");
-        DKObject<DKData> embossData = resourcePool.LoadResourceData("shaders/ComputeShader/emboss.comp.spv");
-        DKObject<DKData> edgedetectData = resourcePool.LoadResourceData("shaders/ComputeShader/edgedetect.comp.spv");
-        DKObject<DKData> sharpenData = resourcePool.LoadResourceData("shaders/ComputeShader/sharpen.comp.spv");
+        DKObject<GPUShader> vs = DKOBJECT_NEW GPUShader(resourcePool, "shaders/ComputeShader/texture.vert.spv");
+        DKObject<GPUShader> fs = DKOBJECT_NEW GPUShader(resourcePool, "shaders/ComputeShader/texture.frag.spv");
 
+        DKObject<GPUShader> cs_e = DKOBJECT_NEW GPUShader(resourcePool, "shaders/ComputeShader/emboss.comp.spv");
+        DKObject<GPUShader> cs_ed = DKOBJECT_NEW GPUShader(resourcePool, "shaders/ComputeShader/edgedetect.comp.spv");
+        DKObject<GPUShader> cs_sh = DKOBJECT_NEW GPUShader(resourcePool, "shaders/ComputeShader/sharpen.comp.spv");
 
-        DKObject<GPUShader> vs = DKOBJECT_NEW GPUShader(vertData);
-        DKObject<GPUShader> fs = DKOBJECT_NEW GPUShader(fragData);
+        // shader modules and pipeline states, created once per key (see pipelinecache.h).
+        PipelineCache pipelineCache(device);
 
-        DKObject<GPUShader> cs_e = DKOBJECT_NEW GPUShader(embossData);
-        DKObject<GPUShader> cs_ed = DKOBJECT_NEW GPUShader(edgedetectData);
-        DKObject<GPUShader> cs_sh = DKOBJECT_NEW GPUShader(sharpenData);
+        vs->InitializeGpuResource(pipelineCache);
+        fs->InitializeGpuResource(pipelineCache);
 
-        vs->InitializeGpuResource(graphicsQueue);
-        fs->InitializeGpuResource(graphicsQueue);
-
-        cs_e->InitializeGpuResource(computeQueue);
-        cs_ed->InitializeGpuResource(computeQueue);
-        cs_sh->InitializeGpuResource(computeQueue);
+        cs_e->InitializeGpuResource(pipelineCache);
+        cs_ed->InitializeGpuResource(pipelineCache);
+        cs_sh->InitializeGpuResource(pipelineCache);
 
         auto vsf = vs->Function();
         auto fsf = fs->Function();
@@ -280,7 +235,7 @@ public:
         auto cs_shf = cs_sh->Function();
 
         // Texture Resource Initialize
-		DKObject<DKTexture> sourceTexture = LoadTexture2D(graphicsQueue, resourcePool.LoadResourceData("textures/Vulkan.png"));
+		DKObject<DKTexture> sourceTexture = textureRequest->Wait();
         DKObject<DKTexture> targetTexture = [](DKGraphicsDevice* device, int width, int height) {
             DKTextureDescriptor texDesc = {};
             texDesc.textureType = DKTexture::Type2D;
@@ -345,7 +300,7 @@ public:
 		pipelineDescriptor.rasterizationEnabled = true;
 
 		DKPipelineReflection reflection;
-		DKObject<DKRenderPipelineState> pipelineState = device->CreateRenderPipeline(pipelineDescriptor, &reflection);
+		DKObject<DKRenderPipelineState> pipelineState = pipelineCache.CreateRenderPipeline(pipelineDescriptor, &reflection);
 		if (pipelineState)
 		{
             PrintPipelineReflection(&reflection, DKLogCategory::Verbose);
@@ -384,9 +339,13 @@ public:
 
         DKComputePipelineDescriptor embossComputePipelineDescriptor = {};
         embossComputePipelineDescriptor.computeFunction = cs_ef;
-        DKObject<DKComputePipelineState> emboss = device->CreateComputePipeline(embossComputePipelineDescriptor);
+        DKObject<DKComputePipelineState> emboss = pipelineCache.CreateComputePipeline(embossComputePipelineDescriptor);
+
+        RenderTargetPool renderTargets(device);
 
-        DKObject<DKTexture> depthBuffer = nullptr;
+        // command buffers of the frames, created ahead of the frame loop.
+        CommandBufferPool graphicsCommandBuffers(graphicsQueue);
+        CommandBufferPool computeCommandBuffers(computeQueue);
 
         DKTimer timer;
 		timer.Reset();
@@ -394,6 +353,7 @@ public:
 		DKLog("Render thread begin");
 		while (!runningRenderThread.CompareAndSet(0, 0))
 		{
+			framePacer.BeginFrame();
 			DKRenderPassDescriptor rpd = swapChain->CurrentRenderPassDescriptor();
 			double t = timer.Elapsed();
 			double waveT = (cos(t) + 1.0) * 0.5;
@@ -401,27 +361,18 @@ public:
 
             int width = rpd.colorAttachments.Value(0).renderTarget->Width();
             int height = rpd.colorAttachments.Value(0).renderTarget->Height();
-            if (depthBuffer)
-            {
-                if (depthBuffer->Width() !=  width ||
-                    depthBuffer->Height() != height )
-                    depthBuffer = nullptr;
-            }
-            if (depthBuffer == nullptr)
-            {
-                // create depth buffer
-                DKTextureDescriptor texDesc = {};
-                texDesc.textureType = DKTexture::Type2D;
-                texDesc.pixelFormat = DKPixelFormat::D32Float;
-                texDesc.width = width;
-                texDesc.height = height;
-                texDesc.depth = 1;
-                texDesc.mipmapLevels = 1;
-                texDesc.sampleCount = 1;
-                texDesc.arrayLength = 1;
-                texDesc.usage = DKTexture::UsageRenderTarget;
-                depthBuffer = device->CreateTexture(texDesc);
-            }
+            // depth buffer of the frame, pooled (created again only for a new size).
+            DKTextureDescriptor texDesc = {};
+            texDesc.textureType = DKTexture::Type2D;
+            texDesc.pixelFormat = DKPixelFormat::D32Float;
+            texDesc.width = width;
+            texDesc.height = height;
+            texDesc.depth = 1;
+            texDesc.mipmapLevels = 1;
+            texDesc.sampleCount = 1;
+            texDesc.arrayLength = 1;
+            texDesc.usage = DKTexture::UsageRenderTarget;
+            DKObject<DKTexture> depthBuffer = renderTargets.Acquire(texDesc);
             rpd.depthStencilAttachment.renderTarget = depthBuffer;
             rpd.depthStencilAttachment.loadAction = DKRenderPassAttachmentDescriptor::LoadActionClear;
             rpd.depthStencilAttachment.storeAction = DKRenderPassAttachmentDescriptor::StoreActionDontCare;
@@ -432,7 +383,7 @@ public:
 
             if (1)
             {
-                auto commandBuffer = computeQueue->CreateCommandBuffer();
+                auto commandBuffer = computeCommandBuffers.Acquire();
                 computeEncoder = commandBuffer->CreateComputeCommandEncoder();
             }
             if (1)
@@ -441,7 +392,7 @@ public:
                 if (computeQueue == graphicsQueue && useSingleCommandBuffer)
                     commandBuffer = computeEncoder->CommandBuffer();
                 else
-                    commandBuffer = graphicsQueue->CreateCommandBuffer();
+                    commandBuffer = graphicsCommandBuffers.Acquire();
 
                 renderEncoder = commandBuffer->CreateRenderCommandEncoder(rpd);
             }
@@ -472,24 +423,34 @@ public:
 
 				renderEncoder->SetRenderPipelineState(pipelineState);
 				renderEncoder->SetVertexBuffer(quad->VertexBuffer(), 0, 0);
-				renderEncoder->SetIndexBuffer(quad->IndexBuffer(), 0, DKIndexType::UInt32);
+				renderEncoder->SetIndexBuffer(quad->IndexBuffer(), 0, quad->IndexType());
                 renderEncoder->SetResources(0, graphicShaderBindingSet->PostcomputeDescSet());
 				// draw scene!
 				renderEncoder->DrawIndexed(quad->IndicesCount(), 1, 0, 0, 0);
                 renderEncoder->EndEncoding();
+                renderTargets.Use(depthBuffer, renderEncoder->CommandBuffer());
 
                 if (computeEncoder->CommandBuffer() != renderEncoder->CommandBuffer())
-                    computeEncoder->CommandBuffer()->Commit();
-
-                renderEncoder->CommandBuffer()->Commit();
+                {
+                    computeCommandBuffers.Commit(computeEncoder->CommandBuffer());
+                    graphicsCommandBuffers.Commit(renderEncoder->CommandBuffer());
+                }
+                else
+                    computeCommandBuffers.Commit(renderEncoder->CommandBuffer());
 
-				swapChain->Present();
+				framePacer.Present(swapChain);
 			}
 			else
 			{
 			}
-			DKThread::Sleep(0.01);
+            renderTargets.Release(depthBuffer);
+            renderTargets.NextFrame();
 		}
+        staging.LogStats("ComputeShader");
+        renderTargets.LogStats("ComputeShader");
+        graphicsCommandBuffers.LogStats("ComputeShader graphics");
+        computeCommandBuffers.LogStats("ComputeShader compute");
+        pipelineCache.LogStats("ComputeShader");
 		DKLog("RenderThread terminating...");
 	}
 
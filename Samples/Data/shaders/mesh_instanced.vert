@@ -0,0 +1,38 @@
+#version 450
+
+// mesh.vert with a model matrix per instance.
+// mesh_instanced.vert.spv is built with the Vulkan SDK:
+//   glslangValidator -V mesh_instanced.vert -o mesh_instanced.vert.spv
+//   spirv-val mesh_instanced.vert.spv
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inColor;
+layout (location = 2) in vec2 inTexCoord;
+
+layout (binding = 0) uniform UBO 
+{
+	mat4 projection;
+	mat4 model;
+	mat4 view;
+} ubo;
+
+// model matrices of the visible instances, in draw order.
+layout (std430, binding = 2) readonly buffer Instances
+{
+	mat4 models[];
+} instances;
+
+layout (location = 0) out vec3 fragColor;
+layout (location = 1) out vec2 fragTexCoord;
+
+out gl_PerVertex 
+{
+    vec4 gl_Position;   
+};
+
+void main() 
+{
+	gl_Position = ubo.projection * ubo.view * instances.models[gl_InstanceIndex] * ubo.model * vec4(inPos, 1.0);
+	fragColor = inColor;
+	fragTexCoord = inTexCoord;
+}
@@ -1,133 +1,15 @@
 #include <cstddef>
 #include "app.h"
 #include "util.h"
+#include "commandpool.h"
+#include "pipelinecompiler.h"
+#include "rendertargetpool.h"
+#include "texturestream.h"
 
-//#define TINYOBJLOADER_IMPLMENTATION
-#include "tiny_obj_loader.h"
+#include "objmesh.h"
 #include <unordered_map>
 
 
-class SampleObjMesh
-{
-public:
-	struct Vertex
-	{
-		DKVector3 inPos;
-		DKVector3 inColor;
-		DKVector2 intexCoord;
-
-		int Compare(const Vertex& Other) const
-		{
-            const float pp[] = { this->inPos.x, this->inPos.y, this->inPos.z,
-                this->inColor.x, this->inColor.y, this->inColor.z,
-                this->intexCoord.x, this->intexCoord.y};
-            const float rr[] = { Other.inPos.x, Other.inPos.y, Other.inPos.z,
-                Other.inColor.x, Other.inColor.y, Other.inColor.z,
-                Other.intexCoord.x, Other.intexCoord.y};
-
-            for (int i = 0; i < std::size(pp); ++i)
-            {
-                auto k = pp[i] - rr[i];
-                if (abs(k) < 0.0001)
-                    continue;
-                if (k > 0)
-                    return 1;
-                else if (k < 0)
-                    return -1;
-            }
-            return 0;
-		}
-
-		bool operator > (const Vertex& Other) const
-		{
-			return Compare(Other) > 0;
-		}
-
-		bool operator < (const Vertex& Other) const
-		{
-			return Compare(Other) < 0;
-		}
-	};
-
-	SampleObjMesh() 
-	{
-		vertices.Reserve(100);
-		indices.Reserve(100);
-	}
-
-	void LoadFromObjFile(const char* InPath)
-	{
-		tinyobj::attrib_t attrib;
-		std::vector<tinyobj::shape_t> shapes;
-		std::vector<tinyobj::material_t> materials;
-		std::string err;
-		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, InPath)) {
-			throw std::runtime_error(err);
-		}
-		
-		DKMap<Vertex, uint32_t> uniqueVertices;
-		DKLog("Save to Container");
-		for (const auto& shape : shapes)
-		{
-			for (const auto& index : shape.mesh.indices)
-			{
-				Vertex vertex = {};
-
-				vertex.inPos = {
-					attrib.vertices[3 * index.vertex_index + 0],
-					attrib.vertices[3 * index.vertex_index + 1],
-					attrib.vertices[3 * index.vertex_index + 2]
-				};
-
-				if (attrib.texcoords.size())
-				{
-					vertex.intexCoord = {
-					attrib.texcoords[2 * index.texcoord_index + 0],
-					1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-					};
-				}				
-
-				vertex.inColor = { 1.0f, 1.0f, 1.0f };
-
-				if (uniqueVertices.Find(vertex) == nullptr)
-				{
-					uniqueVertices.Insert(vertex, static_cast<uint32_t>(vertices.Count()));
-					vertices.Add(vertex);
-				}
-
-				indices.Add(uniqueVertices.Value(vertex));
-
-                aabb.Expand(vertex.inPos);
-			}
-		}
-	}
-
-	uint32_t GetVerticesCount() const { 
-		return static_cast<uint32_t>(vertices.Count()); };
-	uint32_t GetIndicesCount() const { 
-		return static_cast<uint32_t>(indices.Count()); };
-	const Vertex* GetVerticesData() const { 
-		return vertices; }
-	const uint32_t* GetIndicesData() const { 
-		return indices; }
-
-    DKAabb aabb;
-private:
-	DKArray<Vertex> vertices;
-	DKArray<uint32_t> indices;
-	DKSpinLock                  MeshLock;
-};
-
-///// Template Spealization for DKString. (for DKMap, DKSet)
-//template <> struct DKMapKeyComparator<SampleObjMesh::Vertex>
-//{
-//	int operator () (const DKStringW& lhs, const DKStringW& rhs) const
-//	{
-//		return lhs.Compare(rhs);
-//	}
-//};
-
-
 class MaterialDemo : public SampleApp
 {
     DKObject<DKWindow> window;
@@ -142,55 +24,10 @@ public:
 		DKLog("Loading Mesh");
         DKString path = resourcePool.ResourceFilePath("meshes/VikingRoom/viking_room.obj");
 		SampleMesh->LoadFromObjFile(DKStringU8(path));
+        SampleMesh->BuildLods();
+        DKLog("Mesh LODs: %u", SampleMesh->GetLodCount());
 	}
 
-    DKObject<DKTexture> LoadTexture2D(DKCommandQueue* queue, DKData* data)
-    {
-        DKObject<DKImage> image = DKImage::Create(data);
-        if (image)
-        {
-            DKGraphicsDevice* device = queue->Device();
-            DKTextureDescriptor texDesc = {};
-            texDesc.textureType = DKTexture::Type2D;
-            texDesc.pixelFormat = DKPixelFormat::RGBA8Unorm;
-            texDesc.width = image->Width();
-            texDesc.height = image->Height();
-            texDesc.depth = 1;
-            texDesc.mipmapLevels = 1;
-            texDesc.sampleCount = 1;
-            texDesc.arrayLength = 1;
-            texDesc.usage = DKTexture::UsageCopyDestination | DKTexture::UsageSampled;
-            DKObject<DKTexture> tex = device->CreateTexture(texDesc);
-            if (tex)
-            {
-                size_t bytesPerPixel = image->BytesPerPixel();
-                DKASSERT_DESC(bytesPerPixel == DKPixelFormatBytesPerPixel(texDesc.pixelFormat), "BytesPerPixel mismatch!");
-
-                uint32_t width = image->Width();
-                uint32_t height = image->Height();
-
-                size_t bufferLength = bytesPerPixel * width * height;
-                DKObject<DKGpuBuffer> stagingBuffer = device->CreateBuffer(bufferLength, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-                
-                memcpy(stagingBuffer->Contents(), image->Contents(), bufferLength);
-                stagingBuffer->Flush();
-
-                DKObject<DKCommandBuffer> cb = queue->CreateCommandBuffer();
-                DKObject<DKCopyCommandEncoder> encoder = cb->CreateCopyCommandEncoder();
-                encoder->CopyFromBufferToTexture(stagingBuffer,
-                                                 { 0, width, height },
-                                                 tex,
-                                                 { 0,0, 0,0,0 },
-                                                 { width,height,1 });
-                encoder->EndEncoding();
-                cb->Commit();
-
-                DKLog("Texture created!");
-                return tex;
-            }
-        }
-        return nullptr;
-    }
 	void RenderThread(void)
 	{
 		DKObject<DKData> vertData = resourcePool.LoadResourceData("shaders/mesh.vert.spv");
@@ -201,23 +38,43 @@ public:
 		DKObject<DKGraphicsDevice> device = DKGraphicsDevice::SharedInstance();
         DKObject<DKCommandQueue> queue = device->CreateCommandQueue(DKCommandQueue::Graphics);
 
+        // decoded and uploaded while the mesh and material are being set up.
+        TextureStreamer textureStreamer(queue);
+        DKObject<TextureRequest> textureRequest = textureStreamer.LoadTexture2D(DKStringU8(resourcePool.ResourceFilePath("meshes/VikingRoom/viking_room.png")),
+            DKTexture::UsageCopyDestination | DKTexture::UsageSampled,
+            TextureLoadFlagMipmaps | TextureLoadFlagCache);
+
 		DKObject<DKSwapChain> swapChain = queue->CreateSwapChain(window);
 
+        // device local buffers are uploaded through a ring of staging buffers kept for the queue.
+        StagingBufferRing staging(queue);
+        // command buffers of the frames, created ahead of the frame loop.
+        CommandBufferPool commandBuffers(queue);
+        // shader modules and pipeline states, created once per key (see pipelinecache.h).
+        PipelineCache pipelineCache(device);
+
         DKObject<DKMesh> mesh = DKOBJECT_NEW DKMesh();
 
+        // one index buffer per LOD, all LODs share the vertex buffer.
+        struct LodIndexBuffer
+        {
+            DKObject<DKGpuBuffer> buffer;
+            uint32_t indexCount;
+            DKIndexType indexType;
+        };
+        DKArray<LodIndexBuffer> lodIndexBuffers;
+
         if (true)
         {
             // setup vertex buffer, index buffer
 		    uint32_t vertexBufferSize = static_cast<uint32_t>(SampleMesh->GetVerticesCount()) * sizeof(SampleObjMesh::Vertex);
-		    uint32_t indexBufferSize = SampleMesh->GetIndicesCount() * sizeof(uint32_t);
-
-		    DKObject<DKGpuBuffer> vertexBuffer = device->CreateBuffer(vertexBufferSize, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-		    memcpy(vertexBuffer->Contents(), SampleMesh->GetVerticesData(), vertexBufferSize);
-            vertexBuffer->Flush();
+            // DKMesh draws all indices at once, without base vertex.
+            IndexBufferData indexData;
+            SampleMesh->BuildIndexBufferData(indexData, false);
+		    uint32_t indexBufferSize = static_cast<uint32_t>(indexData.data.Count());
 
-		    DKObject<DKGpuBuffer> indexBuffer = device->CreateBuffer(indexBufferSize, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-		    memcpy(indexBuffer->Contents(), SampleMesh->GetIndicesData(), indexBufferSize);
-            indexBuffer->Flush();
+		    DKObject<DKGpuBuffer> vertexBuffer = staging.CreateBuffer(SampleMesh->GetVerticesData(), vertexBufferSize);
+		    DKObject<DKGpuBuffer> indexBuffer = staging.CreateBuffer(indexData.data, indexBufferSize);
 
             mesh->vertexBuffers.Add({
                 {
@@ -234,17 +91,26 @@ public:
             mesh->vertexCount = SampleMesh->GetVerticesCount();
             mesh->indexBuffer = indexBuffer;
             mesh->indexCount = SampleMesh->GetIndicesCount();
-            mesh->indexType = DKIndexType::UInt32;
+            mesh->indexType = indexData.indexType;
             mesh->primitiveType = DKPrimitiveType::Triangle;
+
+            lodIndexBuffers.Add({ indexBuffer, mesh->indexCount, mesh->indexType });
+            const SampleObjMesh::Lod* lods = SampleMesh->GetLodData();
+            for (uint32_t i = 1; i < SampleMesh->GetLodCount(); ++i)
+            {
+                // DKMesh draws from the start of its index buffer.
+                const uint32_t* lodIndices = SampleMesh->GetLodIndicesData() + (lods[i].indexStart - SampleMesh->GetIndicesCount());
+                BuildIndexBufferData(lodIndices, lods[i].indexCount, SampleMesh->GetVerticesCount(), nullptr, 0, indexData, false);
+                DKObject<DKGpuBuffer> buffer = staging.CreateBuffer(indexData.data, indexData.data.Count());
+                lodIndexBuffers.Add({ buffer, lods[i].indexCount, indexData.indexType });
+            }
+            staging.Flush();
         }
         if (true)
         {
             // create shaders
-            DKObject<DKShaderModule> vertShaderModule = device->CreateShaderModule(vertShader);
-            DKObject<DKShaderModule> fragShaderModule = device->CreateShaderModule(fragShader);
-
-            DKObject<DKShaderFunction> vertShaderFunction = vertShaderModule->CreateFunction(vertShaderModule->FunctionNames().Value(0));
-            DKObject<DKShaderFunction> fragShaderFunction = fragShaderModule->CreateFunction(fragShaderModule->FunctionNames().Value(0));
+            DKObject<DKShaderFunction> vertShaderFunction = pipelineCache.CreateShaderFunction(vertShader);
+            DKObject<DKShaderFunction> fragShaderFunction = pipelineCache.CreateShaderFunction(fragShader);
 
             DKLog("VertexFunction.VertexAttributes: %d", vertShaderFunction->StageInputAttributes().Count());
             for (int i = 0; i < vertShaderFunction->StageInputAttributes().Count(); ++i)
@@ -254,11 +120,12 @@ public:
             }
 
             // create texture
-            DKObject<DKTexture> texture = LoadTexture2D(queue, resourcePool.LoadResourceData("meshes/VikingRoom/viking_room.png"));
+            DKObject<DKTexture> texture = textureRequest->Wait();
             // create sampler
             DKSamplerDescriptor samplerDesc = {};
             samplerDesc.magFilter = DKSamplerDescriptor::MinMagFilterLinear;
             samplerDesc.minFilter = DKSamplerDescriptor::MinMagFilterLinear;
+            samplerDesc.mipFilter = DKSamplerDescriptor::MipFilterLinear;
             samplerDesc.addressModeU = DKSamplerDescriptor::AddressModeClampToEdge;
             samplerDesc.addressModeV = DKSamplerDescriptor::AddressModeClampToEdge;
             samplerDesc.addressModeW = DKSamplerDescriptor::AddressModeClampToEdge;
@@ -315,18 +182,25 @@ public:
                 }
             };
         }
-        if (mesh->InitResources(device))
+        // the PSO of the material is built on a worker thread, frames are drawn without the mesh until it is ready.
+        PipelineCompiler pipelineCompiler(pipelineCache);
+        DKObject<PipelineRequest> meshRequest = pipelineCompiler.Compile([&mesh, &device]()
         {
-            PrintPipelineReflection(mesh->PipelineReflection(), DKLogCategory::Verbose);
-
+            return mesh->InitResources(device);
+        });
+        if (true)
+        {
+            bool meshReady = false;
+            uint32_t framesWithoutMesh = 0;
 
-            DKObject<DKTexture> depthBuffer = nullptr;
+            RenderTargetPool renderTargets(device);
 
             DKCamera camera;
             DKVector3 cameraPosition = { 0, 5, 10 };
             DKVector3 cameraTartget = { 0, 0, 0 };
 
             DKAffineTransform3 tm(DKLinearTransform3().Scale(5).Rotate(DKVector3(-1,0,0), DKGL_PI * 0.5));
+            uint32_t currentLod = 0;
 
             DKTimer timer;
             timer.Reset();
@@ -334,6 +208,26 @@ public:
             DKLog("Render thread begin");
             while (!runningRenderThread.CompareAndSet(0, 0))
             {
+                framePacer.BeginFrame();
+                if (meshRequest)
+                {
+                    // the mesh is not touched by this thread until InitResources() returns.
+                    if (meshRequest->IsDone())
+                    {
+                        meshReady = meshRequest->Succeeded();
+                        if (meshReady)
+                        {
+                            DKLog("Material ready after %.3fs (%u frames without the mesh)",
+                                  meshRequest->Latency(), framesWithoutMesh);
+                            PrintPipelineReflection(mesh->PipelineReflection(), DKLogCategory::Verbose);
+                        }
+                        else
+                            DKLogE("Failed to initialize mesh resources");
+                        meshRequest = nullptr;
+                    }
+                    else
+                        framesWithoutMesh++;
+                }
                 DKRenderPassDescriptor rpd = swapChain->CurrentRenderPassDescriptor();
                 double t = timer.Elapsed();
                 double waveT = (cos(t) + 1.0) * 0.5;
@@ -341,79 +235,90 @@ public:
 
                 int width = rpd.colorAttachments.Value(0).renderTarget->Width();
                 int height = rpd.colorAttachments.Value(0).renderTarget->Height();
-                if (depthBuffer)
-                {
-                    if (depthBuffer->Width() !=  width ||
-                        depthBuffer->Height() != height )
-                        depthBuffer = nullptr;
-                }
-                if (depthBuffer == nullptr)
-                {
-                    // create depth buffer
-                    DKTextureDescriptor texDesc = {};
-                    texDesc.textureType = DKTexture::Type2D;
-                    texDesc.pixelFormat = DKPixelFormat::D32Float;
-                    texDesc.width = width;
-                    texDesc.height = height;
-                    texDesc.depth = 1;
-                    texDesc.mipmapLevels = 1;
-                    texDesc.sampleCount = 1;
-                    texDesc.arrayLength = 1;
-                    texDesc.usage = DKTexture::UsageRenderTarget;
-                    depthBuffer = device->CreateTexture(texDesc);
-                }
+                // depth buffer of the frame, pooled (created again only for a new size).
+                DKTextureDescriptor texDesc = {};
+                texDesc.textureType = DKTexture::Type2D;
+                texDesc.pixelFormat = DKPixelFormat::D32Float;
+                texDesc.width = width;
+                texDesc.height = height;
+                texDesc.depth = 1;
+                texDesc.mipmapLevels = 1;
+                texDesc.sampleCount = 1;
+                texDesc.arrayLength = 1;
+                texDesc.usage = DKTexture::UsageRenderTarget;
+                DKObject<DKTexture> depthBuffer = renderTargets.Acquire(texDesc);
                 rpd.depthStencilAttachment.renderTarget = depthBuffer;
                 rpd.depthStencilAttachment.loadAction = DKRenderPassAttachmentDescriptor::LoadActionClear;
                 rpd.depthStencilAttachment.storeAction = DKRenderPassAttachmentDescriptor::StoreActionDontCare;
 
-                DKObject<DKCommandBuffer> buffer = queue->CreateCommandBuffer();
+                DKObject<DKCommandBuffer> buffer = commandBuffers.Acquire();
                 DKObject<DKRenderCommandEncoder> encoder = buffer->CreateRenderCommandEncoder(rpd);
                 if (encoder)
                 {
-                    camera.SetView(cameraPosition, cameraTartget - cameraPosition, DKVector3(0, 1, 0));
-                    camera.SetPerspective(DKGL_DEGREE_TO_RADIAN(90), float(width)/float(height), 1, 1000);
-
-                    DKQuaternion quat(DKVector3(0, 1, 0), t);
-                    DKAffineTransform3 trans = tm * DKAffineTransform3(quat);
-
-                    struct
-                    {
-                        DKMatrix4 projectionMatrix;
-                        DKMatrix4 modelMatrix;
-                        DKMatrix4 viewMatrix;
-                    } ubo;
-                    ubo.projectionMatrix = camera.ProjectionMatrix();
-                    ubo.modelMatrix = trans.Matrix4();
-                    ubo.viewMatrix = camera.ViewMatrix();
-
-                    // update shader properties..
-                    bool bindstruct = true;
-                    if (bindstruct)
-                    {
-                        // bind struct 
-                        mesh->structProperties.Value("ubo").Set(&ubo, sizeof(ubo));
-                    }
-                    else
+                    if (meshReady)
                     {
-                        // bind struct elements separately
-                        mesh->structProperties.Value("ubo.projection").Set(ubo.projectionMatrix.val);
-                        mesh->structProperties.Value("ubo.model").Set(ubo.modelMatrix.val);
-                        mesh->structProperties.Value("ubo.view").Set(ubo.viewMatrix.val);
+                        camera.SetView(cameraPosition, cameraTartget - cameraPosition, DKVector3(0, 1, 0));
+                        camera.SetPerspective(DKGL_DEGREE_TO_RADIAN(90), float(width)/float(height), 1, 1000);
+
+                        DKQuaternion quat(DKVector3(0, 1, 0), t);
+                        DKAffineTransform3 trans = tm * DKAffineTransform3(quat);
+
+                        struct
+                        {
+                            DKMatrix4 projectionMatrix;
+                            DKMatrix4 modelMatrix;
+                            DKMatrix4 viewMatrix;
+                        } ubo;
+                        ubo.projectionMatrix = camera.ProjectionMatrix();
+                        ubo.modelMatrix = trans.Matrix4();
+                        ubo.viewMatrix = camera.ViewMatrix();
+
+                        uint32_t lod = SampleMesh->SelectLod(ubo.modelMatrix * ubo.viewMatrix, ubo.projectionMatrix, float(height));
+                        if (lod != currentLod)
+                        {
+                            DKLog("LOD %u -> %u (%u triangles)", currentLod, lod, lodIndexBuffers.Value(lod).indexCount / 3);
+                            mesh->indexBuffer = lodIndexBuffers.Value(lod).buffer;
+                            mesh->indexCount = lodIndexBuffers.Value(lod).indexCount;
+                            mesh->indexType = lodIndexBuffers.Value(lod).indexType;
+                            currentLod = lod;
+                        }
+
+                        // update shader properties..
+                        bool bindstruct = true;
+                        if (bindstruct)
+                        {
+                            // bind struct 
+                            mesh->structProperties.Value("ubo").Set(&ubo, sizeof(ubo));
+                        }
+                        else
+                        {
+                            // bind struct elements separately
+                            mesh->structProperties.Value("ubo.projection").Set(ubo.projectionMatrix.val);
+                            mesh->structProperties.Value("ubo.model").Set(ubo.modelMatrix.val);
+                            mesh->structProperties.Value("ubo.view").Set(ubo.viewMatrix.val);
+                        }
+
+                        mesh->UpdateMaterialProperties(nullptr);
+                        mesh->EncodeRenderCommand(encoder, 1, 0);
                     }
 
-                    mesh->UpdateMaterialProperties(nullptr);
-                    mesh->EncodeRenderCommand(encoder, 1, 0);
-
                     encoder->EndEncoding();
-                    buffer->Commit();
-                    swapChain->Present();
+                    renderTargets.Use(depthBuffer, buffer);
+                    commandBuffers.Commit(buffer);
+                    framePacer.Present(swapChain);
                 }
                 else
                 {
                 }
-                DKThread::Sleep(0.01);
+                renderTargets.Release(depthBuffer);
+                renderTargets.NextFrame();
             }
+            renderTargets.LogStats("Material");
         }
+        staging.LogStats("Material");
+        commandBuffers.LogStats("Material");
+        pipelineCache.LogStats("Material");
+        pipelineCompiler.LogStats("Material");
 		DKLog("RenderThread terminating...");
 	}
 
@@ -1,129 +1,17 @@
 #include <cstddef>
 #include "app.h"
 #include "util.h"
+#include "commandpool.h"
+#include "pipelinecompiler.h"
+#include "parallelencoder.h"
+#include "rendertargetpool.h"
+#include "texturestream.h"
 
-#include "tiny_obj_loader.h"
-
-
-class SampleObjMesh
-{
-public:
-	struct Vertex
-	{
-		DKVector3 inPos;
-		DKVector3 inColor;
-		DKVector2 intexCoord;
-
-		int Compare(const Vertex& Other) const
-		{
-            const float pp[] = { this->inPos.x, this->inPos.y, this->inPos.z,
-                this->inColor.x, this->inColor.y, this->inColor.z,
-                this->intexCoord.x, this->intexCoord.y};
-            const float rr[] = { Other.inPos.x, Other.inPos.y, Other.inPos.z,
-                Other.inColor.x, Other.inColor.y, Other.inColor.z,
-                Other.intexCoord.x, Other.intexCoord.y};
-
-            for (int i = 0; i < std::size(pp); ++i)
-            {
-                auto k = pp[i] - rr[i];
-                if (abs(k) < 0.0001)
-                    continue;
-                if (k > 0)
-                    return 1;
-                else if (k < 0)
-                    return -1;
-            }
-            return 0;
-		}
-
-		bool operator > (const Vertex& Other) const
-		{
-			return Compare(Other) > 0;
-		}
-
-		bool operator < (const Vertex& Other) const
-		{
-			return Compare(Other) < 0;
-		}
-	};
-
-	SampleObjMesh()
-	{
-		vertices.Reserve(100);
-		indices.Reserve(100);
-	}
-
-	void LoadFromObjFile(const char* InPath)
-	{
-		tinyobj::attrib_t attrib;
-		std::vector<tinyobj::shape_t> shapes;
-		std::vector<tinyobj::material_t> materials;
-		std::string err;
-		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, InPath)) {
-			throw std::runtime_error(err);
-		}
-
-		DKMap<Vertex, uint32_t> uniqueVertices;
-		DKLog("Save to Container");
-		for (const auto& shape : shapes)
-		{
-			for (const auto& index : shape.mesh.indices)
-			{
-				Vertex vertex = {};
-
-				vertex.inPos = {
-					attrib.vertices[3 * index.vertex_index + 0],
-					attrib.vertices[3 * index.vertex_index + 1],
-					attrib.vertices[3 * index.vertex_index + 2]
-				};
-
-				if (attrib.texcoords.size())
-				{
-					vertex.intexCoord = {
-					attrib.texcoords[2 * index.texcoord_index + 0],
-					1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-					};
-				}
-
-				vertex.inColor = { 1.0f, 1.0f, 1.0f };
-
-				if (uniqueVertices.Find(vertex) == nullptr)
-				{
-					uniqueVertices.Insert(vertex, static_cast<uint32_t>(vertices.Count()));
-					vertices.Add(vertex);
-				}
-
-				indices.Add(uniqueVertices.Value(vertex));
-
-                aabb.Expand(vertex.inPos);
-			}
-		}
-	}
-
-	uint32_t GetVerticesCount() const {
-		return static_cast<uint32_t>(vertices.Count()); };
-	uint32_t GetIndicesCount() const {
-		return static_cast<uint32_t>(indices.Count()); };
-	const Vertex* GetVerticesData() const {
-		return vertices; }
-	const uint32_t* GetIndicesData() const {
-		return indices; }
-
-    DKAabb aabb;
-private:
-	DKArray<Vertex> vertices;
-	DKArray<uint32_t> indices;
-	DKSpinLock                  MeshLock;
-};
-
-///// Template Spealization for DKString. (for DKMap, DKSet)
-//template <> struct DKMapKeyComparator<SampleObjMesh::Vertex>
-//{
-//	int operator () (const DKStringW& lhs, const DKStringW& rhs) const
-//	{
-//		return lhs.Compare(rhs);
-//	}
-//};
+#include "objmesh.h"
+#include "objstream.h"
+#include "meshlet.h"
+#include "framering.h"
+#include "instancing.h"
 
 
 class MeshDemo : public SampleApp
@@ -132,121 +20,216 @@ class MeshDemo : public SampleApp
 	DKObject<DKThread> renderThread;
 	DKAtomicNumber32 runningRenderThread;
 	DKObject<SampleObjMesh> SampleMesh;
+    DKString meshPath;
+    bool streamMesh = false; // build gpu buffers directly from .obj in RenderThread
+    SampleObjMesh::VertexLayout vertexLayout = SampleObjMesh::VertexLayoutCompact;
+    bool clusterCulling = true; // draw only meshlets inside the frustum and facing the camera
+    SampleMeshlets meshlets;
+    bool meshLod = true;        // draw simplified LODs when their error is below a pixel
+    bool parallelEncoding = false; // encode large draw lists on worker threads, a render pass per chunk
+    bool instancing = false;    // draw a grid of instances culled on the CPU, one draw per LOD
+    uint32_t instanceGridSize = 100; // instanceGridSize^2 instances
+
+    // tools run by LoadMesh() before the sample, set from the command line (SetOption())
+    bool benchmarkObjLoader = false;    // --benchmark-obj-loader
+    bool benchmarkFloatParser = false;  // --benchmark-float-parser
+    bool reportMeshOptimization = false; // --report-mesh-optimization
+    bool precomputeTextureCache = false; // --precompute-texture-cache
 
 public:
+    // Returns false for an unknown option.
+    bool SetOption(const DKString& option)
+    {
+        if (option == DKString("--benchmark-obj-loader"))
+            benchmarkObjLoader = true;
+        else if (option == DKString("--benchmark-float-parser"))
+            benchmarkFloatParser = true;
+        else if (option == DKString("--report-mesh-optimization"))
+            reportMeshOptimization = true;
+        else if (option == DKString("--precompute-texture-cache"))
+            precomputeTextureCache = true;
+        else
+            return false;
+        return true;
+    }
+
 	void LoadMesh()
 	{
 
 		DKLog("Loading Mesh");
         DKString path = resourcePool.ResourceFilePath("meshes/VikingRoom/viking_room.obj");
-		SampleMesh->LoadFromObjFile(DKStringU8(path));
+        if (benchmarkObjLoader)
+        {
+            // compare tinyobj::LoadObj with LoadObjParallel
+            BenchmarkObjLoader(DKStringU8(path));
+        }
+        if (benchmarkFloatParser)
+        {
+            // tinyobj number parsing over a synthetic 10M-line .obj
+            BenchmarkObjFloatParser(10000000);
+        }
+        if (reportMeshOptimization)
+        {
+            // vertex cache efficiency before/after SampleObjMesh::Optimize()
+            const char* meshes[] = {
+                "meshes/CornellBox/CornellBox-Original.obj",
+                "meshes/Dragon/dragon.obj",
+                "meshes/MoriKnob/testObj.obj",
+                "meshes/Sponza/sponza.obj",
+                "meshes/VikingRoom/viking_room.obj",
+                "meshes/car/Car.obj",
+            };
+            for (const char* mesh : meshes)
+                ReportMeshOptimization(DKStringU8(resourcePool.ResourceFilePath(mesh)));
+        }
+        if (precomputeTextureCache)
+        {
+            // write "<image>.texcache" with all mip levels ahead of the first run
+            PrecomputeTextureCache(DKStringU8(resourcePool.ResourceFilePath("meshes/VikingRoom/viking_room.png")),
+                                   TextureLoadFlagMipmaps);
+        }
+        meshPath = path;
+        if (streamMesh)
+            return;
+		SampleMesh->LoadFromObjFile(DKStringU8(path), SampleObjMesh::LoadFlagWeldAttributes | SampleObjMesh::LoadFlagOptimize);
+        if (clusterCulling)
+        {
+            DKTimer timer;
+            timer.Reset();
+            meshlets.Build(*SampleMesh);
+            DKLog("Meshlets: %u (%u triangles), %.3fs",
+                  meshlets.GetMeshletCount(), meshlets.GetIndicesCount() / 3, timer.Elapsed());
+        }
+        if (meshLod)
+        {
+            DKTimer timer;
+            timer.Reset();
+            SampleMesh->BuildLods();
+            const SampleObjMesh::Lod* lods = SampleMesh->GetLodData();
+            for (uint32_t i = 0; i < SampleMesh->GetLodCount(); ++i)
+                DKLog("LOD %u: %u triangles, error: %f", i, lods[i].indexCount / 3, lods[i].error);
+            DKLog("LODs built in %.3fs", timer.Elapsed());
+        }
 	}
 
-    DKObject<DKTexture> LoadTexture2D(DKCommandQueue* queue, DKData* data)
+    // Turns off the options the others can not be combined with.
+    void ValidateOptions()
     {
-        DKObject<DKImage> image = DKImage::Create(data);
-        if (image)
+        if (streamMesh)
         {
-            DKGraphicsDevice* device = queue->Device();
-            DKTextureDescriptor texDesc = {};
-            texDesc.textureType = DKTexture::Type2D;
-            texDesc.pixelFormat = DKPixelFormat::RGBA8Unorm;
-            texDesc.width = image->Width();
-            texDesc.height = image->Height();
-            texDesc.depth = 1;
-            texDesc.mipmapLevels = 1;
-            texDesc.sampleCount = 1;
-            texDesc.arrayLength = 1;
-            texDesc.usage = DKTexture::UsageCopyDestination | DKTexture::UsageSampled;
-            DKObject<DKTexture> tex = device->CreateTexture(texDesc);
-            if (tex)
-            {
-                size_t bytesPerPixel = image->BytesPerPixel();
-                DKASSERT_DESC(bytesPerPixel == DKPixelFormatBytesPerPixel(texDesc.pixelFormat), "BytesPerPixel mismatch!");
-
-                uint32_t width = image->Width();
-                uint32_t height = image->Height();
-
-                size_t bufferLength = bytesPerPixel * width * height;
-                DKObject<DKGpuBuffer> stagingBuffer = device->CreateBuffer(bufferLength, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-
-                memcpy(stagingBuffer->Contents(), image->Contents(), bufferLength);
-                stagingBuffer->Flush();
-
-                DKObject<DKCommandBuffer> cb = queue->CreateCommandBuffer();
-                DKObject<DKCopyCommandEncoder> encoder = cb->CreateCopyCommandEncoder();
-                encoder->CopyFromBufferToTexture(stagingBuffer,
-                                                 { 0, width, height },
-                                                 tex,
-                                                 { 0,0, 0,0,0 },
-                                                 { width,height,1 });
-                encoder->EndEncoding();
-                cb->Commit();
-
-                DKLog("Texture created!");
-                return tex;
-            }
+            // meshlets, LODs and instance bounds need SampleMesh in memory,
+            // streamed vertices are always VertexLayoutFloat.
+            if (clusterCulling || meshLod || instancing)
+                DKLog("streamMesh: clusterCulling, meshLod and instancing disabled");
+            clusterCulling = false;
+            meshLod = false;
+            instancing = false;
+            vertexLayout = SampleObjMesh::VertexLayoutFloat;
+        }
+        if (instancing && instanceGridSize == 0)
+        {
+            DKLog("instancing: instanceGridSize is 0, instancing disabled");
+            instancing = false;
+        }
+        if (instancing)
+        {
+            // meshlets are culled for one model transform, not per instance.
+            if (clusterCulling)
+                DKLog("instancing: clusterCulling disabled");
+            clusterCulling = false;
+            // the constant color of compact vertices is one per draw, not per instance.
+            if (vertexLayout == SampleObjMesh::VertexLayoutCompact)
+                DKLog("instancing: VertexLayoutCompact replaced with VertexLayoutFloat");
+            vertexLayout = SampleObjMesh::VertexLayoutFloat;
         }
-        return nullptr;
     }
-	void RenderThread(void)
-	{
-		DKObject<DKData> vertData = resourcePool.LoadResourceData("shaders/mesh.vert.spv");
-		DKObject<DKData> fragData = resourcePool.LoadResourceData("shaders/mesh.frag.spv");
-		DKShader vertShader(vertData);
-		DKShader fragShader(fragData);
-
-		DKObject<DKGraphicsDevice> device = DKGraphicsDevice::SharedInstance();
-        DKObject<DKCommandQueue> queue = device->CreateCommandQueue(DKCommandQueue::Graphics);
-
-		// create texture
-		DKObject<DKTexture> texture = LoadTexture2D(queue, resourcePool.LoadResourceData("meshes/VikingRoom/viking_room.png"));
-		// create sampler
-		DKSamplerDescriptor samplerDesc = {};
-		samplerDesc.magFilter = DKSamplerDescriptor::MinMagFilterLinear;
-		samplerDesc.minFilter = DKSamplerDescriptor::MinMagFilterLinear;
-		samplerDesc.addressModeU = DKSamplerDescriptor::AddressModeClampToEdge;
-		samplerDesc.addressModeV = DKSamplerDescriptor::AddressModeClampToEdge;
-		samplerDesc.addressModeW = DKSamplerDescriptor::AddressModeClampToEdge;
-		samplerDesc.maxAnisotropy = 16;
-
-		DKObject<DKSamplerState> sampler = device->CreateSamplerState(samplerDesc);
-
-        // create shaders
-		DKObject<DKShaderModule> vertShaderModule = device->CreateShaderModule(&vertShader);
-		DKObject<DKShaderModule> fragShaderModule = device->CreateShaderModule(&fragShader);
-
-		DKObject<DKShaderFunction> vertShaderFunction = vertShaderModule->CreateFunction(vertShaderModule->FunctionNames().Value(0));
-		DKObject<DKShaderFunction> fragShaderFunction = fragShaderModule->CreateFunction(fragShaderModule->FunctionNames().Value(0));
-
-		DKObject<DKSwapChain> swapChain = queue->CreateSwapChain(window);
-
-		DKLog("VertexFunction.VertexAttributes: %d", vertShaderFunction->StageInputAttributes().Count());
-		for (int i = 0; i < vertShaderFunction->StageInputAttributes().Count(); ++i)
-		{
-			const DKShaderAttribute& attr = vertShaderFunction->StageInputAttributes().Value(i);
-			DKLog("  --> VertexAttribute[%d]: \"%ls\" (location:%u)", i, (const wchar_t*)attr.name, attr.location);
-		}
 
+    // gpu buffers of the mesh, the draws of indexData are LOD 0.
+    struct MeshBuffers
+    {
+        DKObject<DKGpuBuffer> vertexBuffer;
+        DKObject<DKGpuBuffer> indexBuffer;
+        DKObject<DKGpuBuffer> colorBuffer;  // constant color of compact vertices
+        SampleObjMesh::VertexBufferData vertexData;
+        IndexBufferData indexData;
+    };
+
+    void CreateMeshBuffers(DKCommandQueue* queue, StagingBufferRing& staging, MeshBuffers& mesh)
+    {
+        if (streamMesh)
+        {
+            // host memory stays bounded by the staging ring and .obj attributes.
+            StreamingObjMesh streamingMesh;
+            streamingMesh.LoadFromObjFile(DKStringU8(meshPath), queue);
+            mesh.vertexBuffer = streamingMesh.VertexBuffer();
+            mesh.indexBuffer = streamingMesh.IndexBuffer();
+            // streamed indices are written before the vertex count is known.
+            mesh.indexData.indexType = DKIndexType::UInt32;
+            mesh.indexData.draws.Add({ 0, streamingMesh.GetIndicesCount(), 0, -1 });
+            mesh.vertexData.stride = sizeof(SampleObjMesh::Vertex);
+            mesh.vertexData.descriptor = SampleObjMesh::FloatVertexDescriptor();
+            return;
+        }
+        if (meshLod)
+        {
+            // LOD 0 (or its meshlets, same length) followed by the other
+            // LODs, all drawn in ranges of one index buffer, no base vertex.
+            DKArray<uint32_t> indices;
+            DKArray<IndexedDraw> ranges;
+            if (clusterCulling)
+            {
+                indices.Add(meshlets.GetIndicesData(), meshlets.GetIndicesCount());
+                ranges.Add({ 0, meshlets.GetIndicesCount(), 0, -1 });
+            }
+            else
+            {
+                indices.Add(SampleMesh->GetIndicesData(), SampleMesh->GetIndicesCount());
+                const SampleObjMesh::Submesh* submeshes = SampleMesh->GetSubmeshData();
+                for (uint32_t i = 0; i < SampleMesh->GetSubmeshCount(); ++i)
+                    ranges.Add({ submeshes[i].indexStart, submeshes[i].indexCount, 0, submeshes[i].materialId });
+            }
+            indices.Add(SampleMesh->GetLodIndicesData(), SampleMesh->GetLodIndicesCount());
+            BuildIndexBufferData(indices, indices.Count(), SampleMesh->GetVerticesCount(),
+                                 ranges, ranges.Count(), mesh.indexData, false);
+        }
+        else if (clusterCulling)
+        {
+            // meshlets are drawn in ranges of one index buffer, no base vertex.
+            BuildIndexBufferData(meshlets.GetIndicesData(), meshlets.GetIndicesCount(),
+                                 SampleMesh->GetVerticesCount(), nullptr, 0, mesh.indexData, false);
+        }
+        else
+            SampleMesh->BuildIndexBufferData(mesh.indexData);
+        SampleMesh->BuildVertexBufferData(vertexLayout, mesh.vertexData, &mesh.indexData);
 
-		uint32_t vertexBufferSize = static_cast<uint32_t>(SampleMesh->GetVerticesCount()) * sizeof(SampleObjMesh::Vertex);
-		uint32_t indexBufferSize = SampleMesh->GetIndicesCount() * sizeof(uint32_t);
+        uint32_t vertexBufferSize = static_cast<uint32_t>(mesh.vertexData.data.Count());
+        uint32_t indexBufferSize = static_cast<uint32_t>(mesh.indexData.data.Count());
 
-		DKObject<DKGpuBuffer> vertexBuffer = device->CreateBuffer(vertexBufferSize, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-		memcpy(vertexBuffer->Contents(), SampleMesh->GetVerticesData(), vertexBufferSize);
-        vertexBuffer->Flush();
+        mesh.vertexBuffer = staging.CreateBuffer(mesh.vertexData.data, vertexBufferSize);
+        mesh.indexBuffer = staging.CreateBuffer(mesh.indexData.data, indexBufferSize);
 
-		DKObject<DKGpuBuffer> indexBuffer = device->CreateBuffer(indexBufferSize, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-		memcpy(indexBuffer->Contents(), SampleMesh->GetIndicesData(), indexBufferSize);
-        indexBuffer->Flush();
+        if (vertexLayout == SampleObjMesh::VertexLayoutCompact)
+        {
+            // stepped per instance, draws are not instanced (see ValidateOptions).
+            DKVector3 color = SampleObjMesh::ConstantColor();
+            mesh.colorBuffer = staging.CreateBuffer(&color, sizeof(DKVector3));
+        }
+        staging.Flush();
+        DKLog("Vertex buffer: %u bytes (%u bytes per vertex)", vertexBufferSize, mesh.vertexData.stride);
+        DKLog("Index buffer: %u bytes (%u bytes per index, %u draws)",
+              indexBufferSize, mesh.indexData.IndexSize(), (uint32_t)mesh.indexData.draws.Count());
+    }
 
+    DKRenderPipelineDescriptor MeshPipelineDescriptor(DKShaderFunction* vertShaderFunction, DKShaderFunction* fragShaderFunction,
+                                                      DKPixelFormat colorFormat, const DKVertexDescriptor& vertexDescriptor)
+    {
 		DKRenderPipelineDescriptor pipelineDescriptor;
         // setup shader
 		pipelineDescriptor.vertexFunction = vertShaderFunction;
 		pipelineDescriptor.fragmentFunction = fragShaderFunction;
         // setup color-attachment render-targets
 		pipelineDescriptor.colorAttachments.Resize(1);
-		pipelineDescriptor.colorAttachments.Value(0).pixelFormat = swapChain->PixelFormat();
+		pipelineDescriptor.colorAttachments.Value(0).pixelFormat = colorFormat;
         pipelineDescriptor.colorAttachments.Value(0).blendState.enabled = false;
         pipelineDescriptor.colorAttachments.Value(0).blendState.sourceRGBBlendFactor = DKBlendFactor::SourceAlpha;
         pipelineDescriptor.colorAttachments.Value(0).blendState.destinationRGBBlendFactor = DKBlendFactor::OneMinusSourceAlpha;
@@ -255,14 +238,7 @@ public:
         pipelineDescriptor.depthStencilDescriptor.depthWriteEnabled = true;
         pipelineDescriptor.depthStencilDescriptor.depthCompareFunction = DKCompareFunctionLessEqual;
         // setup vertex buffer and attributes
-        pipelineDescriptor.vertexDescriptor.attributes = {
-			{ DKVertexFormat::Float3, offsetof(SampleObjMesh::Vertex, inPos), 0, 0 },
-            { DKVertexFormat::Float3, offsetof(SampleObjMesh::Vertex, inColor), 0, 1 },
-			{ DKVertexFormat::Float2, offsetof(SampleObjMesh::Vertex, intexCoord), 0, 2 },
-		};
-		pipelineDescriptor.vertexDescriptor.layouts = {
-			{ DKVertexStepRate::Vertex, sizeof(SampleObjMesh::Vertex), 0 },
-		};
+        pipelineDescriptor.vertexDescriptor = vertexDescriptor;
         // setup topology and rasterization
 		pipelineDescriptor.primitiveTopology = DKPrimitiveType::Triangle;
 		pipelineDescriptor.frontFace = DKFrontFace::CCW;
@@ -270,14 +246,11 @@ public:
 		pipelineDescriptor.depthClipMode = DKDepthClipMode::Clip;
 		pipelineDescriptor.cullMode = DKCullMode::Back;
 		pipelineDescriptor.rasterizationEnabled = true;
+        return pipelineDescriptor;
+    }
 
-		DKPipelineReflection reflection;
-		DKObject<DKRenderPipelineState> pipelineState = device->CreateRenderPipeline(pipelineDescriptor, &reflection);
-		if (pipelineState)
-		{
-            PrintPipelineReflection(&reflection, DKLogCategory::Verbose);
-		}
-
+    DKShaderBindingSetLayout BindingSetLayout() const
+    {
         DKShaderBindingSetLayout layout;
         if (1)
         {
@@ -297,52 +270,300 @@ public:
             };
             layout.bindings.Add(bindings, 2);
         }
-        DKObject<DKShaderBindingSet> bindSet = device->CreateShaderBindingSet(layout);
+        if (instancing)
+        {
+            // instance transforms, read by mesh_instanced.vert with gl_InstanceIndex
+            DKShaderBinding binding = {
+                2,
+                DKShader::DescriptorTypeStorageBuffer,
+                1,
+                nullptr
+            };
+            layout.bindings.Add(binding);
+        }
+        return layout;
+    }
+
+    struct UBO
+    {
+        DKMatrix4 projectionMatrix;
+        DKMatrix4 modelMatrix;
+        DKMatrix4 viewMatrix;
+    };
+
+    // draws of a frame, instanced draws have the batch of each draw.
+    struct DrawList
+    {
+        const DKArray<IndexedDraw>* draws;
+        const DKArray<InstanceBatch>* batches;
+    };
+
+    // state of SelectDraws() kept across frames.
+    struct DrawSelection
+    {
+        uint32_t currentLod = 0;
+        DKArray<IndexedDraw> lodDraws;
+        DKArray<IndexedDraw> clusterDraws;
+
+        // transforms of the visible instances, a region for each frame in flight.
+        MeshInstances instances;
+        DKObject<DKGpuBuffer> instanceBuffer;
+        size_t instanceRegionLength = 0;
+        DKArray<InstanceBatch> instanceBatches;
+        DKArray<IndexedDraw> instanceDraws;
+        DKArray<InstanceBatch> instanceDrawBatches; // batch of each instanceDraws entry
+        uint64_t visibleInstances = 0;
+        uint32_t culledFrames = 0;
+        double cullTime = 0.0;
+    };
+
+    void CreateInstances(DKGraphicsDevice* device, FrameUniformRing& uniforms, DrawSelection& selection)
+    {
+        selection.instances.AddGrid(instanceGridSize, instanceGridSize, 12.0f);
+        selection.instanceRegionLength = sizeof(DKMatrix4) * selection.instances.Count();
+        selection.instanceBuffer = device->CreateBuffer(selection.instanceRegionLength * uniforms.FramesInFlight(),
+                                                        DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
+        if (selection.instanceBuffer && uniforms.IsValid())
+        {
+            for (uint32_t i = 0; i < uniforms.FramesInFlight(); ++i)
+                uniforms.BindingSet(i)->SetBuffer(2, selection.instanceBuffer,
+                                                  selection.instanceRegionLength * i, selection.instanceRegionLength);
+        }
+        DKLog("Instances: %u (%u bytes per frame)", selection.instances.Count(), (uint32_t)selection.instanceRegionLength);
+    }
 
-        struct UBO
+    // 'model' is the object space transform (before positionDecode).
+    DrawList SelectDraws(DrawSelection& selection, const MeshBuffers& mesh, const DKCamera& camera,
+                         const DKAffineTransform3& model, uint32_t frameIndex, float height)
+    {
+        if (instancing)
         {
-            DKMatrix4 projectionMatrix;
-            DKMatrix4 modelMatrix;
-            DKMatrix4 viewMatrix;
-        };
-        DKObject<DKGpuBuffer> uboBuffer = device->CreateBuffer(sizeof(UBO), DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-        UBO* ubo = nullptr;
-        if (bindSet)
+            if (selection.instanceBuffer)
+            {
+                DKTimer cullTimer;
+                cullTimer.Reset();
+                // object space bounds, like meshlets and LODs.
+                const DKVector3 center = (SampleMesh->aabb.positionMin + SampleMesh->aabb.positionMax) * 0.5f;
+                const float radius = (SampleMesh->aabb.positionMax - SampleMesh->aabb.positionMin).Length() * 0.5f;
+                DKMatrix4* visibleTransforms = reinterpret_cast<DKMatrix4*>(
+                    reinterpret_cast<uint8_t*>(selection.instanceBuffer->Contents()) + selection.instanceRegionLength * frameIndex);
+                const uint32_t numLods = meshLod ? SampleMesh->GetLodCount() : 1;
+                selection.visibleInstances += selection.instances.Cull(model.Matrix4(),
+                                                                       camera.ViewMatrix(), camera.ProjectionMatrix(),
+                                                                       center, radius, numLods,
+                                                                       [&](const DKMatrix4& instanceModelView)
+                                                                       {
+                                                                           return SampleMesh->SelectLod(instanceModelView, camera.ProjectionMatrix(), height);
+                                                                       },
+                                                                       visibleTransforms, selection.instanceBatches);
+                selection.instanceBuffer->Flush();
+                selection.cullTime += cullTimer.Elapsed();
+                selection.culledFrames++;
+            }
+            else
+                selection.instanceBatches.Clear();
+
+            // the draws of each LOD, instanced.
+            selection.instanceDraws.Clear();
+            selection.instanceDrawBatches.Clear();
+            for (const InstanceBatch& batch : selection.instanceBatches)
+            {
+                if (batch.lod > 0)
+                {
+                    const SampleObjMesh::Lod& lod = SampleMesh->GetLodData()[batch.lod];
+                    const SampleObjMesh::Submesh* submeshes = SampleMesh->GetLodSubmeshData() + lod.submeshStart;
+                    for (uint32_t i = 0; i < lod.submeshCount; ++i)
+                    {
+                        selection.instanceDraws.Add({ submeshes[i].indexStart, submeshes[i].indexCount, 0, submeshes[i].materialId });
+                        selection.instanceDrawBatches.Add(batch);
+                    }
+                }
+                else
+                {
+                    for (const IndexedDraw& draw : mesh.indexData.draws)
+                    {
+                        selection.instanceDraws.Add(draw);
+                        selection.instanceDrawBatches.Add(batch);
+                    }
+                }
+            }
+            return { &selection.instanceDraws, &selection.instanceDrawBatches };
+        }
+
+        // meshlet bounds and LOD errors are in object space (before positionDecode)
+        DKMatrix4 modelView = model.Matrix4() * camera.ViewMatrix();
+        if (meshLod)
         {
-            if (uboBuffer)
+            uint32_t lod = SampleMesh->SelectLod(modelView, camera.ProjectionMatrix(), height);
+            if (lod != selection.currentLod)
             {
-                ubo = reinterpret_cast<UBO*>(uboBuffer->Contents());
-                ubo->projectionMatrix = DKMatrix4::identity;
-                ubo->modelMatrix = DKMatrix4::identity;
-                ubo->viewMatrix = DKMatrix4::identity;
-                uboBuffer->Flush();
-
-                //DKAffineTransform3 trans;
-                //trans.Multiply(DKLinearTransform3().Scale(0.5).Rotate(DKVector3(0,1,0), DKGL_PI * 0.5));
-                //ubo.modelMatrix.Multiply(trans.Matrix4());
-
-                //memcpy(uboBuffer->Contents(), &ubo, sizeof(ubo));
-                bindSet->SetBuffer(0, uboBuffer, 0, sizeof(UBO));
+                const SampleObjMesh::Lod& l = SampleMesh->GetLodData()[lod];
+                DKLog("LOD %u -> %u (%u triangles)", selection.currentLod, lod, l.indexCount / 3);
+                selection.currentLod = lod;
             }
+            if (selection.currentLod > 0)
+            {
+                const SampleObjMesh::Lod& lod = SampleMesh->GetLodData()[selection.currentLod];
+                const SampleObjMesh::Submesh* submeshes = SampleMesh->GetLodSubmeshData() + lod.submeshStart;
+                selection.lodDraws.Clear();
+                for (uint32_t i = 0; i < lod.submeshCount; ++i)
+                    selection.lodDraws.Add({ submeshes[i].indexStart, submeshes[i].indexCount, 0, submeshes[i].materialId });
+                return { &selection.lodDraws, nullptr };
+            }
+        }
+        if (clusterCulling)
+        {
+            DKMatrix4 inverseModelView = modelView;
+            inverseModelView.Inverse();
+            DKVector3 cameraInModel(inverseModelView.m[3][0], inverseModelView.m[3][1], inverseModelView.m[3][2]);
+
+            selection.clusterDraws.Clear();
+            meshlets.Cull(modelView * camera.ProjectionMatrix(), cameraInModel, selection.clusterDraws);
+            return { &selection.clusterDraws, nullptr };
+        }
+        return { &mesh.indexData.draws, nullptr };
+    }
 
-            bindSet->SetTexture(1, texture);
-            bindSet->SetSamplerState(1, sampler);
+    void EncodeDraws(DKRenderCommandEncoder* encoder, DKRenderPipelineState* pipelineState, const MeshBuffers& mesh,
+                     DKShaderBindingSet* bindSet, const DrawList& list, uint32_t first, uint32_t count)
+    {
+        if (count == 0)
+            return;
+        encoder->SetRenderPipelineState(pipelineState);
+        encoder->SetVertexBuffer(mesh.vertexBuffer, 0, 0);
+        if (mesh.colorBuffer)
+            encoder->SetVertexBuffer(mesh.colorBuffer, 0, 1);
+        encoder->SetIndexBuffer(mesh.indexBuffer, 0, mesh.indexData.indexType);
+        encoder->SetResources(0, bindSet);
+        // draw scene!
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            const IndexedDraw& draw = list.draws->Value(i);
+            if (list.batches)
+            {
+                const InstanceBatch& batch = list.batches->Value(i);
+                encoder->DrawIndexed(draw.indexCount, batch.instanceCount, draw.firstIndex, draw.vertexOffset, batch.firstInstance);
+            }
+            else
+                encoder->DrawIndexed(draw.indexCount, 1, draw.firstIndex, draw.vertexOffset, 0);
         }
+    }
+
+	void RenderThread(void)
+	{
+        const char* vertShaderName = instancing ? "shaders/mesh_instanced.vert.spv" : "shaders/mesh.vert.spv";
+
+        // SPIR-V parsed only to create its module (see pipelinecache.h).
+		CachedShader vertShader(resourcePool, vertShaderName);
+		CachedShader fragShader(resourcePool, "shaders/mesh.frag.spv");
 
-        DKObject<DKTexture> depthBuffer = nullptr;
+		DKObject<DKGraphicsDevice> device = DKGraphicsDevice::SharedInstance();
+        DKObject<DKCommandQueue> queue = device->CreateCommandQueue(DKCommandQueue::Graphics);
+
+		// create texture, decoded and uploaded while buffers and pipeline are being created.
+        TextureStreamer textureStreamer(queue);
+        DKObject<TextureRequest> textureRequest = textureStreamer.LoadTexture2D(DKStringU8(resourcePool.ResourceFilePath("meshes/VikingRoom/viking_room.png")),
+            DKTexture::UsageCopyDestination | DKTexture::UsageSampled,
+            TextureLoadFlagMipmaps | TextureLoadFlagCache);
+		// create sampler
+		DKSamplerDescriptor samplerDesc = {};
+		samplerDesc.magFilter = DKSamplerDescriptor::MinMagFilterLinear;
+		samplerDesc.minFilter = DKSamplerDescriptor::MinMagFilterLinear;
+		samplerDesc.mipFilter = DKSamplerDescriptor::MipFilterLinear;
+		samplerDesc.addressModeU = DKSamplerDescriptor::AddressModeClampToEdge;
+		samplerDesc.addressModeV = DKSamplerDescriptor::AddressModeClampToEdge;
+		samplerDesc.addressModeW = DKSamplerDescriptor::AddressModeClampToEdge;
+		samplerDesc.maxAnisotropy = 16;
+
+		DKObject<DKSamplerState> sampler = device->CreateSamplerState(samplerDesc);
+
+        // shader modules and pipeline states, created once per key (see pipelinecache.h).
+        PipelineCache pipelineCache(device);
+		DKObject<DKShaderFunction> vertShaderFunction = pipelineCache.CreateShaderFunction(vertShader);
+		DKObject<DKShaderFunction> fragShaderFunction = pipelineCache.CreateShaderFunction(fragShader);
+
+		DKObject<DKSwapChain> swapChain = queue->CreateSwapChain(window);
+
+		DKLog("VertexFunction.VertexAttributes: %d", vertShaderFunction->StageInputAttributes().Count());
+		for (int i = 0; i < vertShaderFunction->StageInputAttributes().Count(); ++i)
+		{
+			const DKShaderAttribute& attr = vertShaderFunction->StageInputAttributes().Value(i);
+			DKLog("  --> VertexAttribute[%d]: \"%ls\" (location:%u)", i, (const wchar_t*)attr.name, attr.location);
+		}
+
+
+        // device local buffers are uploaded through a ring of staging buffers kept for the queue.
+        StagingBufferRing staging(queue);
+        MeshBuffers mesh;
+        CreateMeshBuffers(queue, staging, mesh);
+
+        // compiled on a worker thread, frames are drawn without the mesh until it is ready.
+        PipelineCompiler pipelineCompiler(pipelineCache);
+        DKObject<PipelineRequest> pipelineRequest = pipelineCompiler.CompileRenderPipeline(
+            MeshPipelineDescriptor(vertShaderFunction, fragShaderFunction, swapChain->PixelFormat(), mesh.vertexData.descriptor));
+        DKObject<DKRenderPipelineState> pipelineState = nullptr;
+        uint32_t framesWithoutPipeline = 0;
+
+        // uniforms of the frames in flight, a binding set for each frame.
+        FrameUniformRing uniforms(device, sizeof(UBO), BindingSetLayout());
+        const bool useUniforms = uniforms.IsValid();
+        if (useUniforms)
+        {
+            DKTexture* texture = textureRequest->Wait();
+            for (uint32_t i = 0; i < uniforms.FramesInFlight(); ++i)
+            {
+                uniforms.BindingSet(i)->SetTexture(1, texture);
+                uniforms.BindingSet(i)->SetSamplerState(1, sampler);
+            }
+        }
+
+        DrawSelection drawSelection;
+        if (instancing)
+            CreateInstances(device, uniforms, drawSelection);
+
+        RenderTargetPool renderTargets(device);
 
         DKCamera camera;
         DKVector3 cameraPosition = { 0, 5, 10 };
         DKVector3 cameraTartget = { 0, 0, 0 };
+        if (instancing)
+            cameraPosition = { 0, 40, 80 };
 
         DKAffineTransform3 tm(DKLinearTransform3().Scale(5).Rotate(DKVector3(-1,0,0), DKGL_PI * 0.5));
 
+        // command buffers of the frames, created ahead of the frame loop.
+        CommandBufferPool commandBuffers(queue);
+        // with parallelEncoding, draw lists of 1024 draws or more are encoded on worker threads.
+        ParallelRenderEncoder parallelEncoder;
+
         DKTimer timer;
 		timer.Reset();
 
+        // sample the animation time and camera right before the frame is due.
+        framePacer.SetJustInTime(true);
+
 		DKLog("Render thread begin");
 		while (!runningRenderThread.CompareAndSet(0, 0))
 		{
+			framePacer.BeginFrame();
+            if (pipelineRequest)
+            {
+                if (pipelineRequest->IsDone())
+                {
+                    pipelineState = pipelineRequest->RenderPipeline();
+                    if (pipelineState)
+                    {
+                        DKLog("Pipeline ready after %.3fs (%u frames without the mesh)",
+                              pipelineRequest->Latency(), framesWithoutPipeline);
+                        PrintPipelineReflection(&pipelineRequest->Reflection(), DKLogCategory::Verbose);
+                    }
+                    else
+                        DKLogE("Failed to create pipeline");
+                    pipelineRequest = nullptr;
+                }
+                else
+                    framesWithoutPipeline++;
+            }
 			DKRenderPassDescriptor rpd = swapChain->CurrentRenderPassDescriptor();
 			double t = timer.Elapsed();
 			double waveT = (cos(t) + 1.0) * 0.5;
@@ -350,37 +571,42 @@ public:
 
             int width = rpd.colorAttachments.Value(0).renderTarget->Width();
             int height = rpd.colorAttachments.Value(0).renderTarget->Height();
-            if (depthBuffer)
-            {
-                if (depthBuffer->Width() !=  width ||
-                    depthBuffer->Height() != height )
-                    depthBuffer = nullptr;
-            }
-            if (depthBuffer == nullptr)
-            {
-                // create depth buffer
-                DKTextureDescriptor texDesc = {};
-                texDesc.textureType = DKTexture::Type2D;
-                texDesc.pixelFormat = DKPixelFormat::D32Float;
-                texDesc.width = width;
-                texDesc.height = height;
-                texDesc.depth = 1;
-                texDesc.mipmapLevels = 1;
-                texDesc.sampleCount = 1;
-                texDesc.arrayLength = 1;
-                texDesc.usage = DKTexture::UsageRenderTarget;
-                depthBuffer = device->CreateTexture(texDesc);
-            }
+            // depth buffer of the frame, pooled (created again only for a new size).
+            DKTextureDescriptor texDesc = {};
+            texDesc.textureType = DKTexture::Type2D;
+            texDesc.pixelFormat = DKPixelFormat::D32Float;
+            texDesc.width = width;
+            texDesc.height = height;
+            texDesc.depth = 1;
+            texDesc.mipmapLevels = 1;
+            texDesc.sampleCount = 1;
+            texDesc.arrayLength = 1;
+            texDesc.usage = DKTexture::UsageRenderTarget;
+            DKObject<DKTexture> depthBuffer = renderTargets.Acquire(texDesc);
             rpd.depthStencilAttachment.renderTarget = depthBuffer;
             rpd.depthStencilAttachment.loadAction = DKRenderPassAttachmentDescriptor::LoadActionClear;
             rpd.depthStencilAttachment.storeAction = DKRenderPassAttachmentDescriptor::StoreActionDontCare;
 
-			DKObject<DKCommandBuffer> buffer = queue->CreateCommandBuffer();
-			DKObject<DKRenderCommandEncoder> encoder = buffer->CreateRenderCommandEncoder(rpd);
-			if (encoder)
+			DKObject<DKCommandBuffer> buffer = nullptr;
+			DKObject<DKRenderCommandEncoder> encoder = nullptr;
+            if (!parallelEncoding)
+            {
+                buffer = commandBuffers.Acquire();
+                encoder = buffer->CreateRenderCommandEncoder(rpd);
+            }
+			if (encoder || parallelEncoding)
 			{
-                if (bindSet && ubo)
+                DrawList drawList = { instancing ? &drawSelection.instanceDraws : &mesh.indexData.draws, nullptr };
+                DKShaderBindingSet* bindSet = nullptr;
+                uint32_t frameIndex = 0;
+                if (useUniforms)
                 {
+                    // waits only if the GPU is still reading this frame's uniforms.
+                    FrameUniformRing::Frame frame = uniforms.Begin();
+                    UBO* ubo = reinterpret_cast<UBO*>(frame.contents);
+                    bindSet = frame.bindingSet;
+                    frameIndex = frame.index;
+
                     camera.SetView(cameraPosition, cameraTartget - cameraPosition, DKVector3(0, 1, 0));
                     camera.SetPerspective(DKGL_DEGREE_TO_RADIAN(90), float(width)/float(height), 1, 1000);
 
@@ -388,27 +614,65 @@ public:
                     ubo->viewMatrix = camera.ViewMatrix();
 
                     DKQuaternion quat(DKVector3(0, 1, 0), t);
-                    DKAffineTransform3 trans = tm * DKAffineTransform3(quat);
+                    // compact positions are in [0, 1] of the mesh aabb
+                    DKAffineTransform3 trans = mesh.vertexData.positionDecode * tm * DKAffineTransform3(quat);
                     ubo->modelMatrix = trans.Matrix4();
-                    uboBuffer->Flush();
-                    bindSet->SetBuffer(0, uboBuffer, 0, sizeof(UBO));
+
+                    drawList = SelectDraws(drawSelection, mesh, camera, tm * DKAffineTransform3(quat), frame.index, float(height));
                 }
 
-				encoder->SetRenderPipelineState(pipelineState);
-				encoder->SetVertexBuffer(vertexBuffer, 0, 0);
-				encoder->SetIndexBuffer(indexBuffer, 0, DKIndexType::UInt32);
-                encoder->SetResources(0, bindSet);
-				// draw scene!
-				encoder->DrawIndexed(SampleMesh->GetIndicesCount(), 1, 0, 0, 0);
-				encoder->EndEncoding();
-				buffer->Commit();
-				swapChain->Present();
+                // the pass only clears until the pipeline is compiled.
+                const uint32_t numDraws = pipelineState ? static_cast<uint32_t>(drawList.draws->Count()) : 0;
+                auto encodeDraws = [&](DKRenderCommandEncoder* renderEncoder, uint32_t first, uint32_t count)
+                {
+                    EncodeDraws(renderEncoder, pipelineState, mesh, bindSet, drawList, first, count);
+                };
+                if (parallelEncoding)
+                {
+                    if (parallelEncoder.Encode(commandBuffers, rpd, numDraws, encodeDraws))
+                    {
+                        if (bindSet)
+                            uniforms.End(parallelEncoder.LastCommandBuffer());
+                        renderTargets.Use(depthBuffer, parallelEncoder.LastCommandBuffer());
+                        if (parallelEncoder.Commit(commandBuffers))
+                            framePacer.Present(swapChain);
+                        else if (bindSet)
+                            uniforms.Cancel(frameIndex);
+                    }
+                }
+                else
+                {
+                    encodeDraws(encoder, 0, numDraws);
+                    encoder->EndEncoding();
+                    if (bindSet)
+                        uniforms.End(buffer);
+                    renderTargets.Use(depthBuffer, buffer);
+                    if (commandBuffers.Commit(buffer))
+                        framePacer.Present(swapChain);
+                    else if (bindSet)
+                        uniforms.Cancel(frameIndex);
+                }
 			}
 			else
 			{
 			}
-			DKThread::Sleep(0.01);
+            renderTargets.Release(depthBuffer);
+            renderTargets.NextFrame();
 		}
+        staging.LogStats("Mesh");
+        renderTargets.LogStats("Mesh");
+        DKLog("Mesh uniforms: %u frames in flight, %u stalls (%.3fs)",
+              uniforms.FramesInFlight(), uniforms.Stalls(), uniforms.StallTime());
+        if (drawSelection.culledFrames > 0)
+        {
+            DKLog("Mesh instances: %u, %.1f visible per frame, culling %.3fms per frame",
+                  drawSelection.instances.Count(), double(drawSelection.visibleInstances) / drawSelection.culledFrames,
+                  drawSelection.cullTime / drawSelection.culledFrames * 1000.0);
+        }
+        commandBuffers.LogStats("Mesh");
+        parallelEncoder.LogStats("Mesh");
+        pipelineCache.LogStats("Mesh");
+        pipelineCompiler.LogStats("Mesh");
 		DKLog("RenderThread terminating...");
 	}
 
@@ -431,6 +695,7 @@ public:
 
         SampleMesh = DKOBJECT_NEW SampleObjMesh();
 
+        ValidateOptions();
 		LoadMesh();
 
 		runningRenderThread = 1;
@@ -460,6 +725,19 @@ int main(int argc, const char * argv[])
 #endif
 {
     MeshDemo app;
+#ifdef _WIN32
+    for (int i = 1; i < __argc; ++i)
+    {
+        if (!app.SetOption(DKString(__wargv[i])))
+            DKLog("Unknown option: %ls", __wargv[i]);
+    }
+#else
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!app.SetOption(DKString(argv[i])))
+            DKLog("Unknown option: %s", argv[i]);
+    }
+#endif
 	DKPropertySet::SystemConfig().SetValue("AppDelegate", "AppDelegate");
 	DKPropertySet::SystemConfig().SetValue("GraphicsAPI", "Vulkan");
 	return app.Run();
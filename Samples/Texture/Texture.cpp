@@ -1,6 +1,9 @@
 #include <cstddef>
 #include "app.h"
 #include "util.h"
+#include "commandpool.h"
+#include "pipelinecache.h"
+#include "texturestream.h"
 
 
 class TextureDemo : public SampleApp
@@ -10,67 +13,26 @@ class TextureDemo : public SampleApp
 	DKAtomicNumber32 runningRenderThread;
 
 public:
-    DKObject<DKTexture> LoadTexture2D(DKCommandQueue* queue, DKData* data)
-    {
-        DKObject<DKImage> image = DKImage::Create(data);
-        if (image)
-        {
-            DKGraphicsDevice* device = queue->Device();
-            DKTextureDescriptor texDesc = {};
-            texDesc.textureType = DKTexture::Type2D;
-            texDesc.pixelFormat = DKPixelFormat::RGBA8Unorm;
-            texDesc.width = image->Width();
-            texDesc.height = image->Height();
-            texDesc.depth = 1;
-            texDesc.mipmapLevels = 1;
-            texDesc.sampleCount = 1;
-            texDesc.arrayLength = 1;
-            texDesc.usage = DKTexture::UsageCopyDestination | DKTexture::UsageSampled;
-            DKObject<DKTexture> tex = device->CreateTexture(texDesc);
-            if (tex)
-            {
-                size_t bytesPerPixel = image->BytesPerPixel();
-                uint32_t width = image->Width();
-                uint32_t height = image->Height();
-
-                size_t bufferLength = bytesPerPixel * width * height;
-                DKObject<DKGpuBuffer> stagingBuffer = device->CreateBuffer(bufferLength, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-
-                memcpy(stagingBuffer->Contents(), image->Contents(), bufferLength);
-                stagingBuffer->Flush();
-
-                DKObject<DKCommandBuffer> cb = queue->CreateCommandBuffer();
-                DKObject<DKCopyCommandEncoder> encoder = cb->CreateCopyCommandEncoder();
-                encoder->CopyFromBufferToTexture(stagingBuffer,
-                                                 { 0, width, height },
-                                                 tex,
-                                                 { 0,0, 0,0,0 },
-                                                 { width,height,1 });
-                encoder->EndEncoding();
-                cb->Commit();
-
-                DKLog("Texture created!");
-                return tex;
-            }
-        }
-        return nullptr;
-    }
 	void RenderThread(void)
 	{
-		DKObject<DKData> vertData = resourcePool.LoadResourceData("shaders/texture.vert.spv");
-		DKObject<DKData> fragData = resourcePool.LoadResourceData("shaders/texture.frag.spv");
-		DKShader vertShader(vertData);
-		DKShader fragShader(fragData);
+        // SPIR-V parsed only to create its module (see pipelinecache.h).
+		CachedShader vertShader(resourcePool, "shaders/texture.vert.spv");
+		CachedShader fragShader(resourcePool, "shaders/texture.frag.spv");
 
 		DKObject<DKGraphicsDevice> device = DKGraphicsDevice::SharedInstance();
         DKObject<DKCommandQueue> queue = device->CreateCommandQueue(DKCommandQueue::Graphics);
 
-        // create shaders
-		DKObject<DKShaderModule> vertShaderModule = device->CreateShaderModule(&vertShader);
-		DKObject<DKShaderModule> fragShaderModule = device->CreateShaderModule(&fragShader);
+        // decoded and uploaded while the pipeline is being created.
+        TextureStreamer textureStreamer(queue);
+        DKObject<TextureRequest> textureRequest = textureStreamer.LoadTexture2D(DKStringU8(resourcePool.ResourceFilePath("textures/deathstar3.png")));
+
+        // device local buffers are uploaded through a ring of staging buffers kept for the queue.
+        StagingBufferRing staging(queue);
 
-		DKObject<DKShaderFunction> vertShaderFunction = vertShaderModule->CreateFunction(vertShaderModule->FunctionNames().Value(0));
-		DKObject<DKShaderFunction> fragShaderFunction = fragShaderModule->CreateFunction(fragShaderModule->FunctionNames().Value(0));
+        // shader modules and pipeline states, created once per key (see pipelinecache.h).
+        PipelineCache pipelineCache(device);
+		DKObject<DKShaderFunction> vertShaderFunction = pipelineCache.CreateShaderFunction(vertShader);
+		DKObject<DKShaderFunction> fragShaderFunction = pipelineCache.CreateShaderFunction(fragShader);
 
 		DKObject<DKSwapChain> swapChain = queue->CreateSwapChain(window);
 
@@ -95,16 +57,14 @@ public:
             { {  0.5f, -0.5f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 0.0f, 1.0f } }
 		};
 		uint32_t vertexBufferSize = static_cast<uint32_t>(vertexData.Count()) * sizeof(Vertex);
-        DKArray<uint32_t> indexData = { 0, 1, 2, 2, 3, 0 };
-		uint32_t indexBufferSize = static_cast<uint32_t>(indexData.Count()) * sizeof(uint32_t);
+        DKArray<uint32_t> indices = { 0, 1, 2, 2, 3, 0 };
+        IndexBufferData indexData;
+        BuildIndexBufferData(indices, indices.Count(), vertexData.Count(), nullptr, 0, indexData);
+		uint32_t indexBufferSize = static_cast<uint32_t>(indexData.data.Count());
 
-		DKObject<DKGpuBuffer> vertexBuffer = device->CreateBuffer(vertexBufferSize, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-		memcpy(vertexBuffer->Contents(), vertexData, vertexBufferSize);
-        vertexBuffer->Flush();
-
-		DKObject<DKGpuBuffer> indexBuffer = device->CreateBuffer(indexBufferSize, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-		memcpy(indexBuffer->Contents(), indexData, indexBufferSize);
-        indexBuffer->Flush();
+		DKObject<DKGpuBuffer> vertexBuffer = staging.CreateBuffer(vertexData, vertexBufferSize);
+		DKObject<DKGpuBuffer> indexBuffer = staging.CreateBuffer(indexData.data, indexBufferSize);
+        staging.Flush();
 
         DKRenderPipelineDescriptor pipelineDescriptor = {};
 		pipelineDescriptor.vertexFunction = vertShaderFunction;
@@ -131,7 +91,7 @@ public:
 		pipelineDescriptor.rasterizationEnabled = true;
 
 		DKPipelineReflection reflection;
-		DKObject<DKRenderPipelineState> pipelineState = device->CreateRenderPipeline(pipelineDescriptor, &reflection);
+		DKObject<DKRenderPipelineState> pipelineState = pipelineCache.CreateRenderPipeline(pipelineDescriptor, &reflection);
 		if (pipelineState)
 		{
             PrintPipelineReflection(&reflection, DKLogCategory::Verbose);
@@ -179,45 +139,52 @@ public:
             }
 
             // create texture
-            DKObject<DKTexture> texture = LoadTexture2D(queue, resourcePool.LoadResourceData("textures/deathstar3.png"));
+            DKObject<DKTexture> texture = textureRequest->Wait();
             // create sampler
             DKSamplerDescriptor samplerDesc = {};
+            samplerDesc.mipFilter = DKSamplerDescriptor::MipFilterLinear;
             DKObject<DKSamplerState> sampler = device->CreateSamplerState(samplerDesc);
 
             bindSet->SetTexture(1, texture);
             bindSet->SetSamplerState(1, sampler);
         }
 
+        // command buffers of the frames, created ahead of the frame loop.
+        CommandBufferPool commandBuffers(queue);
+
 		DKTimer timer;
 		timer.Reset();
 
 		DKLog("Render thread begin");
 		while (!runningRenderThread.CompareAndSet(0, 0))
 		{
+			framePacer.BeginFrame();
 			DKRenderPassDescriptor rpd = swapChain->CurrentRenderPassDescriptor();
 			double t = timer.Elapsed();
 			t = (cos(t) + 1.0) * 0.5;
 			rpd.colorAttachments.Value(0).clearColor = DKColor(t, 0.0, 0.0, 0.0);
 
-			DKObject<DKCommandBuffer> buffer = queue->CreateCommandBuffer();
+			DKObject<DKCommandBuffer> buffer = commandBuffers.Acquire();
 			DKObject<DKRenderCommandEncoder> encoder = buffer->CreateRenderCommandEncoder(rpd);
 			if (encoder)
 			{
 				encoder->SetRenderPipelineState(pipelineState);
 				encoder->SetVertexBuffer(vertexBuffer, 0, 0);
-				encoder->SetIndexBuffer(indexBuffer, 0, DKIndexType::UInt32);
+				encoder->SetIndexBuffer(indexBuffer, 0, indexData.indexType);
                 encoder->SetResources(0, bindSet);
 				// draw scene!
-				encoder->DrawIndexed(indexData.Count(), 1, 0, 0, 0);
+				encoder->DrawIndexed(indexData.IndexCount(), 1, 0, 0, 0);
 				encoder->EndEncoding();
-				buffer->Commit();
-				swapChain->Present();
+				commandBuffers.Commit(buffer);
+				framePacer.Present(swapChain);
 			}
 			else
 			{
 			}
-			DKThread::Sleep(0.01);
 		}
+        staging.LogStats("Texture");
+        commandBuffers.LogStats("Texture");
+        pipelineCache.LogStats("Texture");
 		DKLog("RenderThread terminating...");
 	}
 
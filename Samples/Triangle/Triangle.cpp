@@ -1,6 +1,8 @@
 
 #include "app.h"
 #include "util.h"
+#include "commandpool.h"
+#include "pipelinecache.h"
 
 
 class TriangleDemo : public SampleApp
@@ -12,17 +14,15 @@ class TriangleDemo : public SampleApp
 public:
 	void RenderThread(void)
 	{
-		DKObject<DKData> vertData = resourcePool.LoadResourceData("shaders/triangle.vert.spv");
-		DKObject<DKData> fragData = resourcePool.LoadResourceData("shaders/triangle.frag.spv");
-		DKShader vertShader(vertData);
-		DKShader fragShader(fragData);
+        // SPIR-V parsed only to create its module (see pipelinecache.h).
+		CachedShader vertShader(resourcePool, "shaders/triangle.vert.spv");
+		CachedShader fragShader(resourcePool, "shaders/triangle.frag.spv");
 
 		DKObject<DKGraphicsDevice> device = DKGraphicsDevice::SharedInstance();
-		DKObject<DKShaderModule> vertShaderModule = device->CreateShaderModule(&vertShader);
-		DKObject<DKShaderModule> fragShaderModule = device->CreateShaderModule(&fragShader);
-
-		DKObject<DKShaderFunction> vertShaderFunction = vertShaderModule->CreateFunction(vertShaderModule->FunctionNames().Value(0));
-		DKObject<DKShaderFunction> fragShaderFunction = fragShaderModule->CreateFunction(fragShaderModule->FunctionNames().Value(0));
+        // shader modules and pipeline states, created once per key (see pipelinecache.h).
+        PipelineCache pipelineCache(device);
+		DKObject<DKShaderFunction> vertShaderFunction = pipelineCache.CreateShaderFunction(vertShader);
+		DKObject<DKShaderFunction> fragShaderFunction = pipelineCache.CreateShaderFunction(fragShader);
 
 		DKObject<DKCommandQueue> queue = device->CreateCommandQueue(DKCommandQueue::Graphics);
 		DKObject<DKSwapChain> swapChain = queue->CreateSwapChain(window);
@@ -46,14 +46,16 @@ public:
 			{ { -0.5f,  0.5f, 0.0f },{ 0.0f, 0.0f, 1.0f } }
 		};
 		uint32_t vertexBufferSize = static_cast<uint32_t>(vertexData.Count()) * sizeof(Vertex);
-		DKArray<uint32_t> indexData = { 0, 1, 2 };
-		uint32_t indexBufferSize = indexData.Count() * sizeof(uint32_t);
+		DKArray<uint32_t> indices = { 0, 1, 2 };
+		IndexBufferData indexData;
+		BuildIndexBufferData(indices, indices.Count(), vertexData.Count(), nullptr, 0, indexData);
+		uint32_t indexBufferSize = static_cast<uint32_t>(indexData.data.Count());
 
 		DKObject<DKGpuBuffer> vertexBuffer = device->CreateBuffer(vertexBufferSize, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
 		memcpy(vertexBuffer->Contents(), vertexData, vertexBufferSize);
 
 		DKObject<DKGpuBuffer> indexBuffer = device->CreateBuffer(indexBufferSize, DKGpuBuffer::StorageModeShared, DKCpuCacheModeReadWrite);
-		memcpy(indexBuffer->Contents(), indexData, indexBufferSize);
+		memcpy(indexBuffer->Contents(), indexData.data, indexBufferSize);
 
 		DKRenderPipelineDescriptor pipelineDescriptor;
 		pipelineDescriptor.vertexFunction = vertShaderFunction;
@@ -76,7 +78,7 @@ public:
 		pipelineDescriptor.rasterizationEnabled = true;
 
 		DKPipelineReflection reflection;
-		DKObject<DKRenderPipelineState> pipelineState = device->CreateRenderPipeline(pipelineDescriptor, &reflection);
+		DKObject<DKRenderPipelineState> pipelineState = pipelineCache.CreateRenderPipeline(pipelineDescriptor, &reflection);
 		if (pipelineState)
 		{
             PrintPipelineReflection(&reflection, DKLogCategory::Verbose);
@@ -115,36 +117,41 @@ public:
             }
         }
 
+        // command buffers of the frames, created ahead of the frame loop.
+        CommandBufferPool commandBuffers(queue);
+
 		DKTimer timer;
 		timer.Reset();
 
 		DKLog("Render thread begin");
 		while (!runningRenderThread.CompareAndSet(0, 0))
 		{
+			framePacer.BeginFrame();
 			DKRenderPassDescriptor rpd = swapChain->CurrentRenderPassDescriptor();
 			double t = timer.Elapsed();
 			t = (cos(t) + 1.0) * 0.5;
 			rpd.colorAttachments.Value(0).clearColor = DKColor(t, 0.0, 0.0, 0.0);
 
-			DKObject<DKCommandBuffer> buffer = queue->CreateCommandBuffer();
+			DKObject<DKCommandBuffer> buffer = commandBuffers.Acquire();
 			DKObject<DKRenderCommandEncoder> encoder = buffer->CreateRenderCommandEncoder(rpd);
 			if (encoder)
 			{
 				encoder->SetRenderPipelineState(pipelineState);
 				encoder->SetVertexBuffer(vertexBuffer, 0, 0);
-				encoder->SetIndexBuffer(indexBuffer, 0, DKIndexType::UInt32);
+				encoder->SetIndexBuffer(indexBuffer, 0, indexData.indexType);
                 encoder->SetResources(0, bindSet);
 				// draw scene!
-				encoder->DrawIndexed(indexData.Count(), 1, 0, 0, 0);
+				encoder->DrawIndexed(indexData.IndexCount(), 1, 0, 0, 0);
 				encoder->EndEncoding();
-				buffer->Commit();
-				swapChain->Present();
+				commandBuffers.Commit(buffer);
+				framePacer.Present(swapChain);
 			}
 			else
 			{
 			}
-			DKThread::Sleep(0.01);
 		}
+        commandBuffers.LogStats("Triangle");
+        pipelineCache.LogStats("Triangle");
 		DKLog("RenderThread terminating...");
 	}
 